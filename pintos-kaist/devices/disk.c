@@ -7,9 +7,27 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If a PCI IDE controller with bus-master DMA support (such as
+   the PIIX3 that QEMU emulates) is found, sector data is moved
+   by the controller using a physical region descriptor (PRD)
+   table, up to DMA_MAX_SECTORS sectors per command and one
+   interrupt per command.  Otherwise we fall back to PIO.
+
+   Requests are not carried out by the thread that makes them.
+   disk_submit() queues a request on its channel and returns; a
+   per-channel I/O thread picks requests off the queue in C-LOOK
+   order (ascending sector number from the current head position,
+   wrapping around to the lowest pending sector), merges runs of
+   requests for adjacent sectors into a single DMA command, and
+   calls each request's completion callback.  disk_read() and
+   disk_write() and their _multiple variants are blocking
+   wrappers around disk_submit(). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +50,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +66,42 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus-master IDE port addresses, relative to the channel's
+   bus-master base.  See the Intel PIIX3 datasheet. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ACTIVE 0x01      /* Bus master active. */
+#define BM_STA_ERROR 0x02       /* Transfer error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
+#define BM_STA_DMA_CAPABLE 0x60 /* Drive 0/1 DMA capable (read/write). */
+
+/* Physical region descriptor.  Describes one physically
+   contiguous piece of a DMA buffer. */
+struct prd {
+	uint32_t addr;              /* Physical base address. */
+	uint16_t size;              /* Byte count, 0 means 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last entry. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* PRD table size.  Entries never span a page, so a request of
+   DISK_REQUEST_MAX sectors needs at most
+   DISK_REQUEST_MAX * DISK_SECTOR_SIZE / PGSIZE + 1 of them; the
+   rest of the table is room for merged requests. */
+#define PRD_CNT 64
+
+/* Most sectors moved by one DMA command, merged or not. */
+#define DMA_MAX_SECTORS 256
 
 /* An ATA device. */
 struct disk {
@@ -68,14 +123,37 @@ struct channel {
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	uint16_t bm_base;           /* Bus-master I/O port, 0 if no DMA. */
+	struct prd *prdt;           /* PRD table for DMA transfers. */
+
+	/* Request queue.  Only the channel's I/O thread touches the
+	   controller once disk_init() has returned. */
+	struct lock lock;           /* Protects the fields below. */
+	struct condition queue_nonempty;    /* Signaled by disk_submit(). */
+	struct list queue;          /* Pending requests, by (device, sector). */
+	int head_dev;               /* Device and sector just past the last */
+	disk_sector_t head_sec;     /* ...transfer, for C-LOOK. */
+
+	/* Statistics. */
+	int queue_depth;            /* Requests now in the queue. */
+	int max_queue_depth;        /* Largest QUEUE_DEPTH seen. */
+	long long request_cnt;      /* Requests submitted. */
+	long long command_cnt;      /* Commands issued to the controller. */
+	long long merge_cnt;        /* Requests merged into another's command. */
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
+/* One PRD table per channel.  The controller requires the table
+   to be 4-byte aligned and not to cross a 64 kB boundary; aligning
+   it to its own size guarantees both. */
+static struct prd prd_tables[2][PRD_CNT]
+	__attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 /* We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
@@ -84,11 +162,26 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static uint16_t find_bus_master (void);
+
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static bool can_dma (const struct channel *, const void *buffer);
+static size_t prd_entries (const void *buffer, size_t size);
+static void dma_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *batch, bool write);
+static void pio_read (struct disk *, disk_sector_t, void *);
+static void pio_write (struct disk *, disk_sector_t, const void *);
+
+static void io_thread (void *channel_);
+static bool request_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+static void take_batch (struct channel *, struct list *batch);
+static void run_batch (struct channel *, struct list *batch);
+
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
 static void select_device (const struct disk *);
@@ -99,6 +192,7 @@ static void interrupt_handler (struct intr_frame *);
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -119,10 +213,22 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
 
+		lock_init (&c->lock);
+		cond_init (&c->queue_nonempty);
+		list_init (&c->queue);
+		c->head_dev = 0;
+		c->head_sec = 0;
+		c->queue_depth = c->max_queue_depth = 0;
+		c->request_cnt = c->command_cnt = c->merge_cnt = 0;
+
+		/* The secondary channel's bus-master registers follow the
+		   primary's. */
+		c->bm_base = bm_base != 0 ? bm_base + 8 * chan_no : 0;
+		c->prdt = prd_tables[chan_no];
+
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = &c->devices[dev_no];
@@ -150,6 +256,14 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		/* Start the channel's I/O thread. */
+		if (c->devices[0].is_ata || c->devices[1].is_ata) {
+			char name[16];
+			snprintf (name, sizeof name, "%s-io", c->name);
+			if (thread_create (name, PRI_MAX, io_thread, c) == TID_ERROR)
+				PANIC ("%s: cannot start I/O thread", c->name);
+		}
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
@@ -162,6 +276,7 @@ disk_print_stats (void) {
 	int chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
+		struct channel *c = &channels[chan_no];
 		int dev_no;
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -170,6 +285,11 @@ disk_print_stats (void) {
 				printf ("%s: %lld reads, %lld writes\n",
 						d->name, d->read_cnt, d->write_cnt);
 		}
+		if (c->request_cnt > 0)
+			printf ("%s: %lld requests, %lld commands, %lld merged, "
+					"queue depth %d (max %d)\n",
+					c->name, c->request_cnt, c->command_cnt, c->merge_cnt,
+					c->queue_depth, c->max_queue_depth);
 	}
 }
 
@@ -203,29 +323,85 @@ disk_size (struct disk *d) {
 	return d->capacity;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for DISK_SECTOR_SIZE bytes.
+/* Queues request R and returns without waiting for it.  R's
+   DISK, SEC_NO, CNT, BUFFER and WRITE members describe the
+   transfer; CNT must be between 1 and DISK_REQUEST_MAX.  BUFFER
+   must be a kernel address: the transfer is done by the I/O
+   thread, whose page table is not the caller's.  When the
+   transfer is done, R->DONE (if nonnull) is called with R and
+   R->AUX from the channel's I/O thread.  DONE must not block on
+   disk I/O itself.  R must stay valid until then.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 void
-disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+disk_submit (struct disk_request *r) {
 	struct channel *c;
 
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (r != NULL);
+	ASSERT (r->disk != NULL);
+	ASSERT (r->buffer != NULL);
+	ASSERT (is_kernel_vaddr (r->buffer));
+	ASSERT (r->cnt >= 1 && r->cnt <= DISK_REQUEST_MAX);
+	ASSERT (r->sec_no + r->cnt <= r->disk->capacity);
 
-	c = d->channel;
+	c = r->disk->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
+	list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+	c->request_cnt++;
+	if (++c->queue_depth > c->max_queue_depth)
+		c->max_queue_depth = c->queue_depth;
+	cond_signal (&c->queue_nonempty, &c->lock);
 	lock_release (&c->lock);
 }
 
+/* Completion callback for the blocking wrappers. */
+static void
+wake_waiter (struct disk_request *r UNUSED, void *done) {
+	sema_up (done);
+}
+
+/* Moves CNT sectors starting at SEC_NO between disk D and BUFFER,
+   in requests of at most DISK_REQUEST_MAX sectors, and waits for
+   all of them to finish. */
+static void
+transfer_sync (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer, bool write) {
+	struct disk_request r;
+	struct semaphore done;
+	uint8_t *p = buffer;
+
+	ASSERT (d != NULL);
+	ASSERT (buffer != NULL);
+
+	sema_init (&done, 0);
+	while (cnt > 0) {
+		size_t n = cnt < DISK_REQUEST_MAX ? cnt : DISK_REQUEST_MAX;
+
+		r.disk = d;
+		r.sec_no = sec_no;
+		r.cnt = n;
+		r.buffer = p;
+		r.write = write;
+		r.done = wake_waiter;
+		r.aux = &done;
+		disk_submit (&r);
+		sema_down (&done);
+
+		sec_no += n;
+		p += n * DISK_SECTOR_SIZE;
+		cnt -= n;
+	}
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for DISK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+	transfer_sync (d, sec_no, 1, buffer, false);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    DISK_SECTOR_SIZE bytes.  Returns after the disk has
    acknowledged receiving the data.
@@ -233,25 +409,333 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	transfer_sync (d, sec_no, 1, (void *) buffer, true);
+}
 
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	transfer_sync (d, sec_no, cnt, buffer, false);
+}
 
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	transfer_sync (d, sec_no, cnt, (void *) buffer, true);
+}
+
+/* Returns true if request A comes before request B in a
+   channel's queue: by device, then by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+	if (a->disk->dev_no != b->disk->dev_no)
+		return a->disk->dev_no < b->disk->dev_no;
+	return a->sec_no < b->sec_no;
+}
+
+/* A channel's I/O thread.  Serves the channel's queue forever. */
+static void
+io_thread (void *channel_) {
+	struct channel *c = channel_;
+
+	for (;;) {
+		struct list batch;
+
+		list_init (&batch);
+		lock_acquire (&c->lock);
+		while (list_empty (&c->queue))
+			cond_wait (&c->queue_nonempty, &c->lock);
+		take_batch (c, &batch);
+		lock_release (&c->lock);
+
+		run_batch (c, &batch);
+	}
+}
+
+/* Moves the next requests to serve from channel C's queue to
+   BATCH.  The first is chosen C-LOOK style: the lowest request at
+   or past the head position, or the lowest request overall if
+   there is none.  Requests that continue it on the same disk in
+   the same direction are merged in, as long as the result fits
+   in one DMA command.  C's lock must be held. */
+static void
+take_batch (struct channel *c, struct list *batch) {
+	struct list_elem *e;
+	struct disk_request *first, *last;
+	size_t sec_cnt, prd_cnt;
+
+	ASSERT (!list_empty (&c->queue));
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		if (r->disk->dev_no > c->head_dev
+				|| (r->disk->dev_no == c->head_dev && r->sec_no >= c->head_sec))
+			break;
+	}
+	if (e == list_end (&c->queue))
+		e = list_begin (&c->queue);
+
+	first = last = list_entry (e, struct disk_request, elem);
+	e = list_remove (e);
+	list_push_back (batch, &first->elem);
+	c->queue_depth--;
+	sec_cnt = first->cnt;
+	prd_cnt = prd_entries (first->buffer, first->cnt * DISK_SECTOR_SIZE);
+
+	/* Requests for the sectors right after LAST follow it in the
+	   sorted queue. */
+	while (e != list_end (&c->queue) && can_dma (c, first->buffer)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		size_t r_prd = prd_entries (r->buffer, r->cnt * DISK_SECTOR_SIZE);
+
+		if (r->disk != first->disk || r->write != first->write
+				|| r->sec_no != last->sec_no + last->cnt
+				|| !can_dma (c, r->buffer)
+				|| sec_cnt + r->cnt > DMA_MAX_SECTORS
+				|| prd_cnt + r_prd > PRD_CNT)
+			break;
+
+		e = list_remove (e);
+		list_push_back (batch, &r->elem);
+		c->queue_depth--;
+		c->merge_cnt++;
+		sec_cnt += r->cnt;
+		prd_cnt += r_prd;
+		last = r;
+	}
+
+	c->head_dev = last->disk->dev_no;
+	c->head_sec = last->sec_no + last->cnt;
+}
+
+/* Carries out the requests in BATCH, as chosen by take_batch(),
+   and calls their completion callbacks. */
+static void
+run_batch (struct channel *c, struct list *batch) {
+	struct disk_request *first =
+		list_entry (list_front (batch), struct disk_request, elem);
+	struct disk *d = first->disk;
+
+	if (can_dma (c, first->buffer)) {
+		struct list_elem *e;
+		size_t cnt = 0;
+
+		for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+			cnt += list_entry (e, struct disk_request, elem)->cnt;
+		dma_transfer (d, first->sec_no, cnt, batch, first->write);
+		c->command_cnt++;
+	} else {
+		size_t i;
+
+		ASSERT (list_size (batch) == 1);
+		for (i = 0; i < first->cnt; i++) {
+			uint8_t *p = (uint8_t *) first->buffer + i * DISK_SECTOR_SIZE;
+			if (first->write)
+				pio_write (d, first->sec_no + i, p);
+			else
+				pio_read (d, first->sec_no + i, p);
+			c->command_cnt++;
+		}
+	}
+
+	while (!list_empty (batch)) {
+		struct disk_request *r =
+			list_entry (list_pop_front (batch), struct disk_request, elem);
+		if (r->done != NULL)
+			r->done (r, r->aux);
+	}
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER using PIO.
+   Only called by D's channel's I/O thread. */
+static void
+pio_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+	struct channel *c = d->channel;
+
+	select_sector (d, sec_no, 1);
+	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+	sema_down (&c->completion_wait);
+	if (!wait_while_busy (d))
+		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+	input_sector (c, buffer);
+	d->read_cnt++;
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER using PIO.
+   Only called by D's channel's I/O thread. */
+static void
+pio_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	struct channel *c = d->channel;
+
+	select_sector (d, sec_no, 1);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
 	if (!wait_while_busy (d))
 		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
 	output_sector (c, buffer);
 	sema_down (&c->completion_wait);
 	d->write_cnt++;
-	lock_release (&c->lock);
 }
-
+
+/* Returns true if BUFFER can be handed to channel C's bus
+   master, i.e. C supports DMA.  disk_submit() only takes kernel
+   buffers, which lie in the kernel's linear mapping of physical
+   memory. */
+static bool
+can_dma (const struct channel *c, const void *buffer) {
+	ASSERT (is_kernel_vaddr (buffer));
+	return c->bm_base != 0;
+}
+
+/* Returns the number of PRD entries needed for the SIZE bytes at
+   BUFFER, i.e. the number of pages they touch. */
+static size_t
+prd_entries (const void *buffer, size_t size) {
+	return pg_no ((const uint8_t *) buffer + size - 1) - pg_no (buffer) + 1;
+}
+
+/* Moves CNT sectors, starting at SEC_NO, between disk D and the
+   buffers of the requests in BATCH, taken in order, with one
+   bus-master DMA command: from the disk into the buffers if
+   WRITE is false, from the buffers to the disk otherwise.
+   Only called by D's channel's I/O thread. */
+static void
+dma_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch, bool write) {
+	struct channel *c = d->channel;
+	struct list_elem *e;
+	size_t prd_cnt = 0;
+	uint8_t bm_status, status;
+
+	ASSERT (cnt > 0 && cnt <= DMA_MAX_SECTORS);
+
+	/* Build the PRD table.  The kernel maps physical memory
+	   linearly, but we still split at page boundaries so that no
+	   entry can cross a 64 kB boundary. */
+	for (e = list_begin (batch); e != list_end (batch); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint8_t *p = r->buffer;
+		size_t left = r->cnt * DISK_SECTOR_SIZE;
+
+		while (left > 0) {
+			size_t chunk = PGSIZE - pg_ofs (p);
+			if (chunk > left)
+				chunk = left;
+
+			ASSERT (prd_cnt < PRD_CNT);
+			c->prdt[prd_cnt].addr = vtop (p);
+			c->prdt[prd_cnt].size = chunk;
+			c->prdt[prd_cnt].flags = 0;
+			prd_cnt++;
+
+			p += chunk;
+			left -= chunk;
+		}
+	}
+	c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+	/* Program the bus master, but don't start it yet. */
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+	outb (reg_bm_status (c), (inb (reg_bm_status (c)) & BM_STA_DMA_CAPABLE)
+			| BM_STA_ERROR | BM_STA_INTR);
+
+	/* Issue the ATA command, then start the transfer and wait for
+	   its completion interrupt. */
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (reg_bm_command (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+	sema_down (&c->completion_wait);
+
+	/* Stop the bus master and check for errors. */
+	outb (reg_bm_command (c), 0);
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), (bm_status & BM_STA_DMA_CAPABLE)
+			| BM_STA_ERROR | BM_STA_INTR);
+	status = inb (reg_alt_status (c));
+	if ((bm_status & BM_STA_ERROR) || (status & (STA_BSY | STA_DRQ | STA_ERR)))
+		PANIC ("%s: disk %s failed, sector=%"PRDSNu", count=%zu",
+				d->name, write ? "write" : "read", sec_no, cnt);
+
+	if (write)
+		d->write_cnt += cnt;
+	else
+		d->read_cnt += cnt;
+}
+
 /* Disk detection and identification. */
 
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Reads the 32-bit PCI configuration register at offset REG of
+   function FUNC of device DEV on bus BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11)
+			| (func << 8) | (reg & 0xfc));
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register at
+   offset REG of function FUNC of device DEV on bus BUS. */
+static void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11)
+			| (func << 8) | (reg & 0xfc));
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that supports bus
+   mastering, enables bus mastering on it, and returns the I/O
+   port of its bus-master registers.  Returns 0 if there is no
+   such controller. */
+static uint16_t
+find_bus_master (void) {
+	int dev, func;
+
+	for (dev = 0; dev < 32; dev++)
+		for (func = 0; func < 8; func++) {
+			uint32_t id = pci_read_config (0, dev, func, 0x00);
+			uint32_t class = pci_read_config (0, dev, func, 0x08);
+			uint32_t bar4;
+
+			if ((id & 0xffff) == 0xffff)
+				continue;
+
+			/* Class 01h (mass storage), subclass 01h (IDE), with
+			   programming interface bit 7 (bus master capable). */
+			if ((class >> 16) != 0x0101 || !(class & 0x8000))
+				continue;
+
+			/* BAR4 must be an I/O space BAR. */
+			bar4 = pci_read_config (0, dev, func, 0x20);
+			if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+				continue;
+
+			/* Enable I/O space and bus master in the command register. */
+			pci_write_config (0, dev, func, 0x04,
+					pci_read_config (0, dev, func, 0x04) | 0x5);
+			return bar4 & 0xfffc;
+		}
+	return 0;
+}
+
 static void print_ata_string (char *string, size_t size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -402,17 +886,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between
+   1 and 256, to the disk's sector selection registers.  (We use
+   LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt >= 1 && cnt <= 256);
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt & 0xff);       /* 0 means 256. */
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -520,6 +1006,9 @@ interrupt_handler (struct intr_frame *f) {
 		if (f->vec_no == c->irq) {
 			if (c->expecting_interrupt) {
 				inb (reg_status (c));               /* Acknowledge interrupt. */
+				if (c->bm_base != 0)                /* Clear bus-master interrupt. */
+					outb (reg_bm_status (c),
+							(inb (reg_bm_status (c)) & BM_STA_DMA_CAPABLE) | BM_STA_INTR);
 				sema_up (&c->completion_wait);      /* Wake up waiter. */
 			} else
 				printf ("%s: unexpected interrupt\n", c->name);
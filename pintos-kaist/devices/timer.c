@@ -17,9 +17,28 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency divided by TIMER_FREQ, rounded to
+   nearest: the PIT count for one timer tick. */
+#define PIT_HZ 1193180
+#define TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot the 16-bit PIT counter can hold, in ticks. */
+#define ONESHOT_MAX_TICKS (0xffff / TICK_COUNT)
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* See timer.h. */
+bool timer_tickless;
+
+/* Number of ticks the PIT is currently programmed to wait in
+   one-shot mode, or 0 if it is running in periodic mode. */
+static int64_t oneshot_ticks;
+
+/* True while the one-shot was started by timer_idle_enter() and
+   has neither expired nor been cut short. */
+static bool oneshot_idle;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -28,22 +47,101 @@ static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
-void timer_sleep (int64_t ticks); 
+static void pit_set_periodic (void);
+static void pit_set_oneshot (uint16_t count);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	pit_set_periodic ();
+	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+}
 
+/* Programs PIT counter 0 to interrupt TIMER_FREQ times per
+   second. */
+static void
+pit_set_periodic (void) {
 	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, TICK_COUNT & 0xff);
+	outb (0x40, TICK_COUNT >> 8);
+}
+
+/* Programs PIT counter 0 to interrupt once, COUNT PIT clocks
+   from now. */
+static void
+pit_set_oneshot (uint16_t count) {
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
 	outb (0x40, count & 0xff);
 	outb (0x40, count >> 8);
+}
 
-	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  If tickless mode is on and no sleeping thread is
+   due within the next tick, switches the PIT to a single interrupt
+   at the earliest sleeper's deadline (or as far as the 16-bit
+   counter allows), so that an idle CPU is not woken every tick. */
+void
+timer_idle_enter (void) {
+	int64_t delta;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!timer_tickless || oneshot_ticks != 0)
+		return;
+
+	delta = thread_next_wakeup () - ticks;
+	if (delta <= 1)
+		return;
+	if (delta > ONESHOT_MAX_TICKS)
+		delta = ONESHOT_MAX_TICKS;
+
+	oneshot_ticks = delta;
+	oneshot_idle = true;
+	pit_set_oneshot (delta * TICK_COUNT);
+}
+
+/* Called by the scheduler, with interrupts off, when the idle
+   thread stops running.  If the CPU was woken by some other
+   interrupt before the one-shot expired, credits the ticks that
+   actually elapsed and lets the PIT run out the tick in progress
+   before it returns to periodic mode, so that no time is lost. */
+void
+timer_idle_exit (void) {
+	uint8_t status;
+	uint16_t remaining;
+	int64_t used;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!oneshot_idle)
+		return;
+	oneshot_idle = false;
+
+	/* Read-back: latch status and count of counter 0. */
+	outb (0x43, 0xc2);
+	status = inb (0x40);
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+
+	/* OUT (bit 7) goes high at terminal count.  The interrupt is
+	   then already pending, and timer_interrupt() will account
+	   for the whole one-shot. */
+	if (status & 0x80)
+		return;
+
+	/* Finish the current tick with a one-shot for what is left of
+	   it.  timer_interrupt() counts that tick and goes back to
+	   periodic mode, so ticks stay where they would have been had
+	   the PIT never left it. */
+	used = oneshot_ticks * TICK_COUNT - remaining;
+	oneshot_ticks = 1;
+	pit_set_oneshot (TICK_COUNT - used % TICK_COUNT);
+
+	ticks += used / TICK_COUNT;
+	thread_idle_ticks (used / TICK_COUNT);
+	thread_wakeup (ticks);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -128,12 +226,20 @@ timer_print_stats (void) {
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
+	if (oneshot_ticks != 0) {
+		/* A one-shot started by timer_idle_enter() expired, or the
+		   rest of a tick after one was cut short.  All but the
+		   current tick were spent idle. */
+		ticks += oneshot_ticks - 1;
+		thread_idle_ticks (oneshot_ticks - 1);
+		oneshot_ticks = 0;
+		oneshot_idle = false;
+		pit_set_periodic ();
+	}
+
 	ticks++;
 	thread_tick ();
-	if(global_tick <= ticks)
-	{
-		wakeup();
-	} 
+	thread_wakeup (ticks);
 }
 
 
@@ -0,0 +1,474 @@
+/* buffer_cache.c: Write-back cache of file system sectors. */
+
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* All reads and writes of file system sectors go through a
+   fixed-size cache of BUFFER_CACHE_SIZE sectors.  Entries are
+   replaced with the clock algorithm.  Writes only dirty the
+   cached copy; dirty sectors reach the disk when they are
+   evicted, every WRITE_BEHIND_INTERVAL ticks from the
+   write-behind thread, and from buffer_cache_done().
+
+   buffer_cache_prefetch() queues sectors for the read-ahead
+   thread, which brings them into the cache in batches so that
+   the disk layer can merge the reads.  Read-ahead only takes
+   entries that are clean, unpinned and not recently used, and at
+   most READ_AHEAD_BATCH of them at a time, so it never waits for
+   a write-back or pushes out sectors in use.  When there are no
+   such entries, queued sectors are dropped.
+
+   CACHE_LOCK protects the table: every entry's SECTOR, PIN_CNT
+   and ACCESSED, and the clock hand.  An entry's own LOCK
+   protects its DIRTY flag and DATA.  While an entry is pinned it
+   will not be evicted, so its SECTOR stays put while the pinner
+   waits for its lock. */
+
+/* Ticks between passes of the write-behind thread. */
+#define WRITE_BEHIND_INTERVAL (TIMER_FREQ * 5)
+
+/* Most sectors waiting for the read-ahead thread.  Requests
+   beyond this are dropped. */
+#define PREFETCH_QUEUE_SIZE 64
+
+/* Most sectors the read-ahead thread reads in one batch. */
+#define READ_AHEAD_BATCH DIV_ROUND_UP (BUFFER_CACHE_SIZE, 8)
+
+/* Marks an entry that holds no sector. */
+#define NO_SECTOR ((disk_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry {
+	disk_sector_t sector;       /* Cached sector, or NO_SECTOR. */
+	int pin_cnt;                /* Threads using or waiting for this entry. */
+	bool accessed;              /* Used since the clock hand last passed? */
+	bool dirty;                 /* Modified since read from disk? */
+	struct lock lock;           /* Protects DIRTY and DATA. */
+	struct disk_request req;    /* Write-back request, for flushes. */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Sector contents. */
+};
+
+static struct cache_entry *cache;
+static size_t clock_hand;
+static struct lock cache_lock;
+static struct condition entry_unpinned;     /* Signaled by cache_put(). */
+
+/* Read-ahead queue, a ring buffer. */
+static disk_sector_t prefetch_queue[PREFETCH_QUEUE_SIZE];
+static size_t prefetch_head, prefetch_cnt;
+static struct lock prefetch_lock;
+static struct condition prefetch_pending;
+
+static struct cache_entry *cache_get (disk_sector_t, bool need_data);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_evict (bool *unlocked);
+static struct cache_entry *cache_find_clean (void);
+static struct cache_entry *cache_claim (struct cache_entry *, disk_sector_t,
+		bool accessed);
+static void write_behind (void *aux);
+static void read_ahead (void *aux);
+
+/* Initializes the buffer cache and starts its write-behind
+   thread. */
+void
+buffer_cache_init (void) {
+	size_t i;
+
+	cache = malloc (sizeof *cache * BUFFER_CACHE_SIZE);
+	if (cache == NULL)
+		PANIC ("buffer cache allocation failed");
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+		e->sector = NO_SECTOR;
+		e->pin_cnt = 0;
+		e->accessed = false;
+		e->dirty = false;
+		lock_init (&e->lock);
+	}
+	clock_hand = 0;
+	lock_init (&cache_lock);
+	cond_init (&entry_unpinned);
+
+	prefetch_head = prefetch_cnt = 0;
+	lock_init (&prefetch_lock);
+	cond_init (&prefetch_pending);
+
+	if (thread_create ("write-behind", PRI_DEFAULT, write_behind, NULL)
+			== TID_ERROR)
+		PANIC ("can't start write-behind thread");
+	if (thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL)
+			== TID_ERROR)
+		PANIC ("can't start read-ahead thread");
+}
+
+/* Copies SIZE bytes starting at byte OFS of sector SECTOR into
+   BUFFER. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer,
+		size_t ofs, size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, true);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e);
+}
+
+/* Copies SIZE bytes from BUFFER into sector SECTOR, starting at
+   byte OFS.  A write that covers the whole sector does not need
+   to read it from disk first. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer,
+		size_t ofs, size_t size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (e->data + ofs, buffer, size);
+	e->dirty = true;
+	cache_put (e);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Returns without waiting.  The request is silently dropped if
+   the read-ahead queue is full. */
+void
+buffer_cache_prefetch (disk_sector_t sector) {
+	lock_acquire (&prefetch_lock);
+	if (prefetch_cnt < PREFETCH_QUEUE_SIZE) {
+		prefetch_queue[(prefetch_head + prefetch_cnt++) % PREFETCH_QUEUE_SIZE]
+			= sector;
+		cond_signal (&prefetch_pending, &prefetch_lock);
+	}
+	lock_release (&prefetch_lock);
+}
+
+/* Completion callback for flushes and read-ahead. */
+static void
+request_done (struct disk_request *r UNUSED, void *done) {
+	sema_up (done);
+}
+
+/* Drops SECTOR from the cache without writing it back, because
+   its contents no longer matter: it has been freed, and may next
+   be written behind the cache's back. */
+void
+buffer_cache_discard (disk_sector_t sector) {
+	size_t i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		if (e->sector != sector)
+			continue;
+
+		/* Wait out a write-back in progress.  While pinned, E keeps
+		   its sector. */
+		e->pin_cnt++;
+		lock_release (&cache_lock);
+		lock_acquire (&e->lock);
+		e->dirty = false;
+		lock_release (&e->lock);
+		lock_acquire (&cache_lock);
+		if (--e->pin_cnt == 0) {
+			e->sector = NO_SECTOR;
+			cond_signal (&entry_unpinned, &cache_lock);
+		}
+		break;
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector in the cache to disk.  The writes
+   are all queued at once, so the disk layer can sort and merge
+   them. */
+void
+buffer_cache_flush (void) {
+	struct semaphore done;
+	size_t i, cnt = 0;
+
+	sema_init (&done, 0);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		lock_acquire (&cache_lock);
+		if (e->sector == NO_SECTOR) {
+			lock_release (&cache_lock);
+			continue;
+		}
+		e->pin_cnt++;
+		lock_release (&cache_lock);
+
+		lock_acquire (&e->lock);
+		if (!e->dirty) {
+			lock_release (&e->lock);
+			cache_put (e);
+			continue;
+		}
+
+		/* Keep E locked until its write finishes. */
+		e->dirty = false;
+		e->req.disk = filesys_disk;
+		e->req.sec_no = e->sector;
+		e->req.cnt = 1;
+		e->req.buffer = e->data;
+		e->req.write = true;
+		e->req.done = request_done;
+		e->req.aux = &done;
+		disk_submit (&e->req);
+		cnt++;
+	}
+
+	while (cnt-- > 0)
+		sema_down (&done);
+
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+		if (lock_held_by_current_thread (&e->lock))
+			cache_put (e);
+	}
+}
+
+/* Writes all dirty sectors to disk, for shutdown. */
+void
+buffer_cache_done (void) {
+	buffer_cache_flush ();
+}
+
+/* Returns the locked, pinned cache entry for SECTOR, bringing it
+   into the cache if necessary.  If NEED_DATA is false, the caller
+   is going to overwrite the whole sector, so a newly cached
+   sector is not read from disk.  Release the entry with
+   cache_put(). */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool need_data) {
+	struct cache_entry *e;
+	size_t i;
+
+	ASSERT (sector != NO_SECTOR);
+
+	lock_acquire (&cache_lock);
+	for (;;) {
+		bool unlocked;
+
+		for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+			e = &cache[i];
+			if (e->sector == sector) {
+				e->pin_cnt++;
+				e->accessed = true;
+				lock_release (&cache_lock);
+				lock_acquire (&e->lock);
+				return e;
+			}
+		}
+
+		/* If the eviction let go of CACHE_LOCK, SECTOR may have
+		   been brought in meanwhile, so look again.  The victim
+		   is clean and unpinned, and is simply left where it is. */
+		e = cache_evict (&unlocked);
+		if (e != NULL && !unlocked)
+			break;
+
+		/* Every entry is pinned.  Wait for one to free up, then
+		   look again, since SECTOR may have been brought in
+		   meanwhile. */
+		if (e == NULL)
+			cond_wait (&entry_unpinned, &cache_lock);
+	}
+
+	cache_claim (e, sector, true);
+	if (need_data)
+		disk_read (filesys_disk, sector, e->data);
+	return e;
+}
+
+/* Makes evicted entry E hold SECTOR, then locks and pins it and
+   releases CACHE_LOCK, which must be held.  An unpinned entry is
+   not locked by anyone, so taking its lock cannot block.  Threads
+   that look up SECTOR before the caller fills in E's data will
+   wait on the lock.  Returns E. */
+static struct cache_entry *
+cache_claim (struct cache_entry *e, disk_sector_t sector, bool accessed) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	ASSERT (e->pin_cnt == 0);
+
+	e->sector = sector;
+	e->pin_cnt = 1;
+	e->accessed = accessed;
+	e->dirty = false;
+	lock_acquire (&e->lock);
+	lock_release (&cache_lock);
+	return e;
+}
+
+/* Unlocks and unpins E. */
+static void
+cache_put (struct cache_entry *e) {
+	lock_release (&e->lock);
+	lock_acquire (&cache_lock);
+	ASSERT (e->pin_cnt > 0);
+	if (--e->pin_cnt == 0)
+		cond_signal (&entry_unpinned, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Chooses an unpinned entry with the clock algorithm, writes it
+   back if it is dirty, and returns it, clean and unpinned.
+   Returns a null pointer if every entry is pinned.  CACHE_LOCK
+   must be held.
+
+   A dirty victim is written back without CACHE_LOCK, so that
+   lookups of other sectors do not wait for the disk.  Meanwhile
+   the victim is pinned and locked but keeps its sector, so a
+   lookup of that sector finds it and waits for its lock instead
+   of reading stale data from disk.  If a lookup did use it, it is
+   passed over like any other accessed entry.  Sets *UNLOCKED to
+   true if CACHE_LOCK was released, in which case the table may
+   have changed since the caller looked at it. */
+static struct cache_entry *
+cache_evict (bool *unlocked) {
+	size_t scanned;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	*unlocked = false;
+	for (scanned = 0; ; scanned++) {
+		struct cache_entry *e = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+
+		/* The first sweep clears every ACCESSED bit, so two full
+		   sweeps without a victim mean every entry is pinned. */
+		if (scanned >= 2 * BUFFER_CACHE_SIZE)
+			return NULL;
+		if (e->pin_cnt > 0)
+			continue;
+		if (e->accessed) {
+			e->accessed = false;
+			continue;
+		}
+
+		if (e->sector != NO_SECTOR && e->dirty) {
+			e->pin_cnt = 1;
+			lock_acquire (&e->lock);
+			lock_release (&cache_lock);
+
+			disk_write (filesys_disk, e->sector, e->data);
+			e->dirty = false;
+
+			lock_acquire (&cache_lock);
+			lock_release (&e->lock);
+			*unlocked = true;
+			if (--e->pin_cnt > 0)
+				continue;
+			if (e->accessed) {
+				cond_signal (&entry_unpinned, &cache_lock);
+				continue;
+			}
+		}
+		return e;
+	}
+}
+
+/* Returns an unpinned, clean entry that was not accessed since the
+   clock hand last passed it, or a null pointer if there is none.
+   Unlike cache_evict(), it neither writes anything back nor clears
+   ACCESSED bits, so that read-ahead leaves the sectors in use
+   alone.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_find_clean (void) {
+	size_t i;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[(clock_hand + i) % BUFFER_CACHE_SIZE];
+
+		if (e->pin_cnt == 0 && !e->accessed
+				&& (e->sector == NO_SECTOR || !e->dirty))
+			return e;
+	}
+	return NULL;
+}
+
+/* Write-behind thread.  Periodically flushes the cache so that
+   dirty sectors do not stay in memory indefinitely. */
+static void
+write_behind (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (WRITE_BEHIND_INTERVAL);
+		buffer_cache_flush ();
+	}
+}
+
+/* Read-ahead thread.  Takes up to READ_AHEAD_BATCH queued
+   sectors, queues reads for those not yet cached all at once,
+   and waits for them to finish.  Entries for read-ahead do not
+   get their ACCESSED bit set, so sectors that are never actually
+   read are the first to be evicted. */
+static void
+read_ahead (void *aux UNUSED) {
+	for (;;) {
+		disk_sector_t sectors[READ_AHEAD_BATCH];
+		struct cache_entry *batch[READ_AHEAD_BATCH];
+		struct semaphore done;
+		size_t sector_cnt = 0, cnt = 0, i, j;
+
+		lock_acquire (&prefetch_lock);
+		while (prefetch_cnt == 0)
+			cond_wait (&prefetch_pending, &prefetch_lock);
+		while (prefetch_cnt > 0 && sector_cnt < READ_AHEAD_BATCH) {
+			sectors[sector_cnt++] = prefetch_queue[prefetch_head];
+			prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+			prefetch_cnt--;
+		}
+		lock_release (&prefetch_lock);
+
+		sema_init (&done, 0);
+		for (j = 0; j < sector_cnt; j++) {
+			disk_sector_t sector = sectors[j];
+			struct cache_entry *e;
+
+			lock_acquire (&cache_lock);
+			for (i = 0; i < BUFFER_CACHE_SIZE; i++)
+				if (cache[i].sector == sector)
+					break;
+			if (i < BUFFER_CACHE_SIZE) {
+				/* Already cached. */
+				lock_release (&cache_lock);
+				continue;
+			}
+			e = cache_find_clean ();
+			if (e == NULL) {
+				/* No room to spare: drop the rest of the batch. */
+				lock_release (&cache_lock);
+				break;
+			}
+			cache_claim (e, sector, false);
+
+			e->req.disk = filesys_disk;
+			e->req.sec_no = sector;
+			e->req.cnt = 1;
+			e->req.buffer = e->data;
+			e->req.write = false;
+			e->req.done = request_done;
+			e->req.aux = &done;
+			disk_submit (&e->req);
+			batch[cnt++] = e;
+		}
+
+		for (i = 0; i < cnt; i++)
+			sema_down (&done);
+		for (i = 0; i < cnt; i++)
+			cache_put (batch[i]);
+	}
+}
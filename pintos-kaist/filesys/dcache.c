@@ -0,0 +1,188 @@
+/* dcache.c: Cache of name lookups in directories. */
+
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* The dentry cache remembers the result of looking up a name in
+   a directory: the inode sector of the file, or that no such
+   file exists (a negative entry).  It holds DCACHE_SIZE entries
+   and evicts the least recently used one when full.
+
+   directory.c invalidates a name whenever it adds or removes it,
+   with the directory's index lock held, and only acts on a hit
+   with that lock held too, so that a file is never opened through
+   a name that was removed in the meantime.
+   A thread that misses in the cache and then searches the
+   directory could still race with such a change, so each
+   invalidation bumps a generation count, and dcache_insert()
+   discards results that were looked up under an older
+   generation. */
+
+/* Marks a negative entry.  Sector 0 holds the free map inode,
+   never a file named in a directory. */
+#define NEGATIVE 0
+
+/* A cached name. */
+struct dentry {
+	struct hash_elem hash_elem;         /* Element in dentries, if valid. */
+	struct list_elem lru_elem;          /* Element in lru_list. */
+	bool valid;                         /* In use? */
+	disk_sector_t parent;               /* Directory's inode sector. */
+	char name[NAME_MAX + 1];            /* Name in the directory. */
+	disk_sector_t child;                /* File's sector, or NEGATIVE. */
+};
+
+static struct dentry dentry_pool[DCACHE_SIZE];
+static struct hash dentries;            /* Valid entries by (parent, name). */
+static struct list lru_list;            /* Most recently used first. */
+static unsigned generation;             /* Bumped by every invalidation. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+static uint64_t
+dentry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+	return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+	if (a->parent != b->parent)
+		return a->parent < b->parent;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void) {
+	size_t i;
+
+	if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+		PANIC ("dentry cache creation failed");
+	list_init (&lru_list);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		dentry_pool[i].valid = false;
+		list_push_back (&lru_list, &dentry_pool[i].lru_elem);
+	}
+	generation = 0;
+	lock_init (&dcache_lock);
+}
+
+/* Returns the valid entry for NAME in PARENT, or a null pointer.
+   dcache_lock must be held. */
+static struct dentry *
+find (disk_sector_t parent, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	key.parent = parent;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dentries, &key.hash_elem);
+	return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+   On a hit, returns true and stores the file's inode sector in
+   *CHILD, or 0 if the cache knows there is no such file.  Returns
+   false on a miss. */
+bool
+dcache_lookup (disk_sector_t parent, const char *name,
+		disk_sector_t *child) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	d = find (parent, name);
+	if (d != NULL) {
+		list_remove (&d->lru_elem);
+		list_push_front (&lru_list, &d->lru_elem);
+		*child = d->child;
+	}
+	lock_release (&dcache_lock);
+	return d != NULL;
+}
+
+/* Returns the current generation.  Read it before searching a
+   directory, and pass it to dcache_insert() with the result. */
+unsigned
+dcache_generation (void) {
+	unsigned g;
+
+	lock_acquire (&dcache_lock);
+	g = generation;
+	lock_release (&dcache_lock);
+	return g;
+}
+
+/* Records that NAME in directory PARENT refers to the inode in
+   sector CHILD, or to nothing if CHILD is 0, as found by a
+   directory search that started at generation GEN.  Does nothing
+   if some name has been invalidated since. */
+void
+dcache_insert (disk_sector_t parent, const char *name,
+		disk_sector_t child, unsigned gen) {
+	struct dentry *d;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	if (gen == generation && find (parent, name) == NULL) {
+		/* Reuse the least recently used entry. */
+		d = list_entry (list_back (&lru_list), struct dentry, lru_elem);
+		if (d->valid)
+			hash_delete (&dentries, &d->hash_elem);
+		d->valid = true;
+		d->parent = parent;
+		strlcpy (d->name, name, sizeof d->name);
+		d->child = child != 0 ? child : NEGATIVE;
+		hash_insert (&dentries, &d->hash_elem);
+		list_remove (&d->lru_elem);
+		list_push_front (&lru_list, &d->lru_elem);
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Removes valid entry D.  dcache_lock must be held. */
+static void
+discard (struct dentry *d) {
+	hash_delete (&dentries, &d->hash_elem);
+	d->valid = false;
+	list_remove (&d->lru_elem);
+	list_push_back (&lru_list, &d->lru_elem);
+}
+
+/* Forgets what is cached about NAME in directory PARENT. */
+void
+dcache_invalidate (disk_sector_t parent, const char *name) {
+	struct dentry *d;
+
+	lock_acquire (&dcache_lock);
+	generation++;
+	d = find (parent, name);
+	if (d != NULL)
+		discard (d);
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for directory PARENT. */
+void
+dcache_invalidate_dir (disk_sector_t parent) {
+	size_t i;
+
+	lock_acquire (&dcache_lock);
+	generation++;
+	for (i = 0; i < DCACHE_SIZE; i++)
+		if (dentry_pool[i].valid && dentry_pool[i].parent == parent)
+			discard (&dentry_pool[i]);
+	lock_release (&dcache_lock);
+}
@@ -1,14 +1,18 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
 	struct inode *inode;                /* Backing store. */
+	struct dir_index *index;            /* Index of its entries. */
 	off_t pos;                          /* Current position. */
 };
 
@@ -19,10 +23,240 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* In-memory index of a directory's entries, built the first time
+ * the directory is searched and kept up to date by dir_add() and
+ * dir_remove() from then on, so that neither has to scan the
+ * directory on disk.
+ *
+ * An index is in dir_indexes for as long as the directory is open:
+ * dir_open() puts an empty one there, and the last dir_close()
+ * frees it, which for a removed directory is also when its sectors
+ * are freed.  It is built under its own lock, not
+ * DIR_INDEXES_LOCK, so building one does not hold up the others.
+ * The file system keeps the root directory open, so that its index
+ * stays in memory. */
+struct dir_index {
+	struct hash_elem elem;              /* Element in dir_indexes. */
+	disk_sector_t sector;               /* Directory's inode sector. */
+	int ref_cnt;                        /* Open handles and users. */
+	struct lock lock;                   /* Protects the members below. */
+	bool built;                         /* Entries read in yet? */
+	struct hash names;                  /* Entries in use, by name. */
+	struct list free_slots;             /* Offsets of unused entries. */
+	off_t end;                          /* Offset just past the last entry. */
+};
+
+/* An entry in use, in a dir_index's NAMES. */
+struct index_entry {
+	struct hash_elem elem;
+	char name[NAME_MAX + 1];            /* Null terminated file name. */
+	disk_sector_t inode_sector;         /* Sector number of header. */
+	off_t ofs;                          /* Offset of the on-disk entry. */
+};
+
+/* An unused entry, in a dir_index's FREE_SLOTS. */
+struct free_slot {
+	struct list_elem elem;
+	off_t ofs;                          /* Offset of the on-disk entry. */
+};
+
+/* Directory entries read at a time while building an index. */
+#define INDEX_READ_CNT 64
+
+/* All directory indexes, by inode sector.  DIR_INDEXES_LOCK
+ * protects the table and every index's REF_CNT. */
+static struct hash dir_indexes;
+static struct lock dir_indexes_lock;
+
+static uint64_t
+dir_index_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct dir_index, elem)->sector);
+}
+
+static bool
+dir_index_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct dir_index, elem)->sector
+		< hash_entry (b, struct dir_index, elem)->sector;
+}
+
+static uint64_t
+index_entry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_string (hash_entry (e, struct index_entry, elem)->name);
+}
+
+static bool
+index_entry_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return strcmp (hash_entry (a, struct index_entry, elem)->name,
+			hash_entry (b, struct index_entry, elem)->name) < 0;
+}
+
+static void
+index_entry_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct index_entry, elem));
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	if (!hash_init (&dir_indexes, dir_index_hash, dir_index_less, NULL))
+		PANIC ("directory index table creation failed");
+	lock_init (&dir_indexes_lock);
+}
+
+/* Forgets every entry in INDEX. */
+static void
+dir_index_clear (struct dir_index *index) {
+	hash_clear (&index->names, index_entry_free);
+	while (!list_empty (&index->free_slots))
+		free (list_entry (list_pop_front (&index->free_slots),
+					struct free_slot, elem));
+}
+
+/* Adds a free slot at OFS to INDEX.  Returns false if out of
+ * memory. */
+static bool
+add_free_slot (struct dir_index *index, off_t ofs) {
+	struct free_slot *slot = malloc (sizeof *slot);
+	if (slot == NULL)
+		return false;
+	slot->ofs = ofs;
+	list_push_front (&index->free_slots, &slot->elem);
+	return true;
+}
+
+/* Adds an entry for NAME at OFS to INDEX.  Returns the new entry,
+ * or a null pointer if out of memory. */
+static struct index_entry *
+add_entry (struct dir_index *index, const char *name,
+		disk_sector_t inode_sector, off_t ofs) {
+	struct index_entry *ie = malloc (sizeof *ie);
+	if (ie == NULL)
+		return NULL;
+	strlcpy (ie->name, name, sizeof ie->name);
+	ie->inode_sector = inode_sector;
+	ie->ofs = ofs;
+	hash_insert (&index->names, &ie->elem);
+	return ie;
+}
+
+/* Reads all of DIR's entries into its index, whose lock must be
+ * held.  Returns false if out of memory. */
+static bool
+dir_index_build (const struct dir *dir) {
+	struct dir_index *index = dir->index;
+	struct dir_entry *entries;
+	off_t ofs = 0;
+	bool ok = true;
+
+	entries = malloc (sizeof *entries * INDEX_READ_CNT);
+	if (entries == NULL)
+		return false;
+
+	while (ok) {
+		off_t bytes = inode_read_at (dir->inode, entries,
+				sizeof *entries * INDEX_READ_CNT, ofs);
+		size_t cnt = bytes / sizeof *entries, i;
+
+		for (i = 0; i < cnt && ok; i++, ofs += sizeof *entries) {
+			if (entries[i].in_use)
+				ok = add_entry (index, entries[i].name,
+						entries[i].inode_sector, ofs) != NULL;
+			else
+				ok = add_free_slot (index, ofs);
+		}
+		if (cnt < INDEX_READ_CNT)
+			break;
+	}
+	index->end = ofs;
+	free (entries);
+
+	if (!ok) {
+		dir_index_clear (index);
+		return false;
+	}
+	index->built = true;
+	return true;
+}
+
+/* Returns a reference to the index for the directory in SECTOR,
+ * to be dropped with dir_index_unref().  If there is none, makes
+ * an empty one if CREATE, and otherwise returns a null pointer, as
+ * it also does if out of memory. */
+static struct dir_index *
+dir_index_ref (disk_sector_t sector, bool create) {
+	struct dir_index key, *index = NULL;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	lock_acquire (&dir_indexes_lock);
+	e = hash_find (&dir_indexes, &key.elem);
+	if (e != NULL)
+		index = hash_entry (e, struct dir_index, elem);
+	else if (create) {
+		index = malloc (sizeof *index);
+		if (index != NULL && !hash_init (&index->names, index_entry_hash,
+					index_entry_less, NULL)) {
+			free (index);
+			index = NULL;
+		}
+		if (index != NULL) {
+			index->sector = sector;
+			index->ref_cnt = 0;
+			lock_init (&index->lock);
+			index->built = false;
+			list_init (&index->free_slots);
+			index->end = 0;
+			hash_insert (&dir_indexes, &index->elem);
+		}
+	}
+	if (index != NULL)
+		index->ref_cnt++;
+	lock_release (&dir_indexes_lock);
+	return index;
+}
+
+/* Drops a reference to INDEX, and frees it along with what the
+ * dentry cache knows about its directory if it was the last. */
+static void
+dir_index_unref (struct dir_index *index) {
+	bool last;
+
+	lock_acquire (&dir_indexes_lock);
+	last = --index->ref_cnt == 0;
+	if (last)
+		hash_delete (&dir_indexes, &index->elem);
+	lock_release (&dir_indexes_lock);
+
+	if (last) {
+		dcache_invalidate_dir (index->sector);
+		dir_index_clear (index);
+		hash_destroy (&index->names, NULL);
+		free (index);
+	}
+}
+
+/* Returns the index for DIR, building it if necessary, with its
+ * lock held.  Returns a null pointer if out of memory. */
+static struct dir_index *
+dir_index_get (const struct dir *dir) {
+	struct dir_index *index = dir->index;
+
+	lock_acquire (&index->lock);
+	if (!index->built && !dir_index_build (dir)) {
+		lock_release (&index->lock);
+		return NULL;
+	}
+	return index;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
+	/* SECTOR may have held a directory that has been removed. */
+	dcache_invalidate_dir (sector);
 	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -31,7 +265,9 @@ dir_create (disk_sector_t sector, size_t entry_cnt) {
 struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
-	if (inode != NULL && dir != NULL) {
+	if (inode != NULL && dir != NULL)
+		dir->index = dir_index_ref (inode_get_inumber (inode), true);
+	if (inode != NULL && dir != NULL && dir->index != NULL) {
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -60,6 +296,7 @@ dir_reopen (struct dir *dir) {
 void
 dir_close (struct dir *dir) {
 	if (dir != NULL) {
+		dir_index_unref (dir->index);
 		inode_close (dir->inode);
 		free (dir);
 	}
@@ -71,52 +308,95 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+/* Searches INDEX for a file with the given NAME and returns its
+ * entry, or a null pointer if there is none.  INDEX's lock must
+ * be held. */
+static struct index_entry *
+lookup (struct dir_index *index, const char *name) {
+	struct index_entry key;
+	struct hash_elem *e;
 
-	ASSERT (dir != NULL);
+	ASSERT (index != NULL);
 	ASSERT (name != NULL);
 
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
-		}
-	return false;
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&index->names, &key.elem);
+	return e != NULL ? hash_entry (e, struct index_entry, elem) : NULL;
 }
 
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * Results, including failed searches, are kept in the dentry
+ * cache. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
-	struct dir_entry e;
+	disk_sector_t dir_sector;
+	struct dir_index *index;
+	struct index_entry *ie;
+	disk_sector_t inode_sector = 0;
+	bool found = false;
+	unsigned gen;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
+	dir_sector = inode_get_inumber (dir->inode);
+	if (dir_lookup_cached (dir_sector, name, inode))
+		return *inode != NULL;
+
+	gen = dcache_generation ();
+	index = dir_index_get (dir);
+	if (index != NULL) {
+		ie = lookup (index, name);
+		if (ie != NULL) {
+			inode_sector = ie->inode_sector;
+			found = true;
+		}
+		lock_release (&index->lock);
+		dcache_insert (dir_sector, name, inode_sector, gen);
+	}
+
+	if (found)
+		*inode = inode_open (inode_sector);
 	else
 		*inode = NULL;
 
 	return *inode != NULL;
 }
 
+/* Looks up NAME in the directory whose inode is in DIR_SECTOR
+ * using only the dentry cache.  On a hit, returns true and sets
+ * *INODE to an inode for the file, or to a null pointer if the
+ * cache knows there is no such file.  Returns false on a miss.
+ *
+ * dir_add() and dir_remove() invalidate names with the index lock
+ * held, so the hit is checked and the inode opened under the same
+ * lock: otherwise the file could be removed, and its sector
+ * reused, between the lookup and the open. */
+bool
+dir_lookup_cached (disk_sector_t dir_sector, const char *name,
+		struct inode **inode) {
+	struct dir_index *index = dir_index_ref (dir_sector, false);
+	disk_sector_t inode_sector;
+	bool hit = false;
+
+	if (index == NULL)
+		return false;
+	lock_acquire (&index->lock);
+	if (index->built)
+		hit = dcache_lookup (dir_sector, name, &inode_sector);
+	if (hit)
+		*inode = inode_sector != 0 ? inode_open (inode_sector) : NULL;
+	lock_release (&index->lock);
+	dir_index_unref (index);
+	return hit;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
  * INODE_SECTOR.
@@ -125,6 +405,9 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_index *index;
+	struct free_slot *slot = NULL;
+	struct index_entry *ie;
 	struct dir_entry e;
 	off_t ofs;
 	bool success = false;
@@ -136,21 +419,27 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
+	index = dir_index_get (dir);
+	if (index == NULL)
+		return false;
+
 	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	if (lookup (index, name) != NULL)
 		goto done;
 
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
-
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
-			break;
+	 * current end-of-file. */
+	if (!list_empty (&index->free_slots)) {
+		slot = list_entry (list_front (&index->free_slots),
+				struct free_slot, elem);
+		ofs = slot->ofs;
+	} else
+		ofs = index->end;
+
+	ie = add_entry (index, name, inode_sector, ofs);
+	if (ie == NULL)
+		goto done;
 
 	/* Write slot. */
 	e.in_use = true;
@@ -158,7 +447,19 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+	if (!success) {
+		hash_delete (&index->names, &ie->elem);
+		free (ie);
+	} else if (slot != NULL) {
+		list_remove (&slot->elem);
+		free (slot);
+	} else
+		index->end += sizeof e;
+	if (success)
+		dcache_invalidate (index->sector, name);
+
 done:
+	lock_release (&index->lock);
 	return success;
 }
 
@@ -167,33 +468,46 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_index *index;
+	struct index_entry *ie;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
-	off_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	index = dir_index_get (dir);
+	if (index == NULL)
+		return false;
+
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	ie = lookup (index, name);
+	if (ie == NULL)
 		goto done;
 
 	/* Open inode. */
-	inode = inode_open (e.inode_sector);
+	inode = inode_open (ie->inode_sector);
 	if (inode == NULL)
 		goto done;
 
-	/* Erase directory entry. */
+	/* Erase directory entry.  Failing to remember the free slot
+	 * only wastes it. */
+	memset (&e, 0, sizeof e);
 	e.in_use = false;
-	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+	if (inode_write_at (dir->inode, &e, sizeof e, ie->ofs) != sizeof e)
 		goto done;
+	add_free_slot (index, ie->ofs);
+	hash_delete (&index->names, &ie->elem);
+	free (ie);
+	dcache_invalidate (index->sector, name);
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	lock_release (&index->lock);
 	inode_close (inode);
 	return success;
 }
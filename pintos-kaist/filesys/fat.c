@@ -1,8 +1,12 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -16,6 +20,12 @@ struct fat_boot {
 	unsigned int root_dir_cluster;
 };
 
+/* Ticks between runs of the FAT flusher. */
+#define FAT_FLUSH_INTERVAL (TIMER_FREQ * 5)
+
+/* Most FAT sectors fat_sync() writes in one disk request. */
+#define FAT_SYNC_RUN 8
+
 /* FAT FS */
 struct fat_fs {
 	struct fat_boot bs;
@@ -24,12 +34,19 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct bitmap *free_map;   /* One bit per cluster, set if in use. */
+	cluster_t alloc_hint;      /* Where to start looking for free clusters. */
+	struct bitmap *dirty;      /* One bit per FAT sector, set if modified. */
+	struct lock sync_lock;     /* Serializes fat_sync(). */
+	unsigned long long sync_cnt; /* FAT sectors written back. */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_build_maps (void);
+static void fat_flusher (void *aux);
 
 void
 fat_init (void) {
@@ -38,12 +55,7 @@ fat_init (void) {
 		PANIC ("FAT init failed");
 
 	// Read boot sector from the disk
-	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT init failed");
-	disk_read (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	memcpy (&fat_fs->bs, bounce, sizeof (fat_fs->bs));
-	free (bounce);
+	buffer_cache_read (FAT_BOOT_SECTOR, &fat_fs->bs, 0, sizeof (fat_fs->bs));
 
 	// Extract FAT info
 	if (fat_fs->bs.magic != FAT_MAGIC)
@@ -53,15 +65,20 @@ fat_init (void) {
 
 void
 fat_open (void) {
+	free (fat_fs->fat);
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
 
-	// Load FAT directly from the disk
+	// Load FAT directly from the disk, past the buffer cache, which
+	// never holds FAT sectors (see fat_sync())
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
+	uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
 	off_t bytes_read = 0;
 	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	if (bounce == NULL)
+		PANIC ("FAT load failed");
 	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
 		bytes_left = fat_size_in_bytes - bytes_read;
 		if (bytes_left >= DISK_SECTOR_SIZE) {
@@ -69,15 +86,26 @@ fat_open (void) {
 			           buffer + bytes_read);
 			bytes_read += DISK_SECTOR_SIZE;
 		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
 			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
 			memcpy (buffer + bytes_read, bounce, bytes_left);
 			bytes_read += bytes_left;
-			free (bounce);
 		}
 	}
+	free (bounce);
+
+	fat_build_maps ();
+
+	// Count the write-back of this FAT only, not a format's
+	fat_fs->sync_cnt = 0;
+
+	// Write back modified FAT sectors in the background
+	static bool flusher_started;
+	if (!flusher_started) {
+		if (thread_create ("fat-flush", PRI_DEFAULT, fat_flusher, NULL)
+		    == TID_ERROR)
+			PANIC ("FAT flusher creation failed");
+		flusher_started = true;
+	}
 }
 
 void
@@ -87,29 +115,83 @@ fat_close (void) {
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
+	buffer_cache_write (FAT_BOOT_SECTOR, bounce, 0, DISK_SECTOR_SIZE);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
+	// Write only the FAT sectors that changed
+	fat_sync ();
+}
+
+/* Copies FAT sector SECTOR, the table's entries padded with
+ * zeros, into BUF.  Must hold write_lock. */
+static void
+copy_fat_sector (size_t sector, uint8_t *buf) {
+	const size_t entries_per_sector = DISK_SECTOR_SIZE / sizeof (cluster_t);
+	size_t first = sector * entries_per_sector, cnt;
+
+	cnt = first < fat_fs->fat_length ? fat_fs->fat_length - first : 0;
+	if (cnt > entries_per_sector)
+		cnt = entries_per_sector;
+	memset (buf, 0, DISK_SECTOR_SIZE);
+	memcpy (buf, fat_fs->fat + first, cnt * sizeof (cluster_t));
+}
+
+/* Writes every modified FAT sector to the disk, in sector order,
+ * a run of up to FAT_SYNC_RUN consecutive sectors per request.
+ * The writes go straight to the disk: the in-memory table is the
+ * only cached copy of the FAT, so it need not also take up buffer
+ * cache entries, and syncing it does not have to flush file data.
+ * When it returns, every FAT update made before the call is
+ * durable. */
+void
+fat_sync (void) {
+	uint8_t *bounce = malloc (FAT_SYNC_RUN * DISK_SECTOR_SIZE);
+	size_t i, cnt;
+
+	if (bounce == NULL)
+		PANIC ("FAT sync failed");
+
+	lock_acquire (&fat_fs->sync_lock);
+	for (i = 0; i < fat_fs->bs.fat_sectors; i += cnt) {
+		// Copy a run of dirty sectors out under the lock, so that
+		// they are consistent, and clear their dirty bits before
+		// writing, so that later updates dirty them again.
+		lock_acquire (&fat_fs->write_lock);
+		i = bitmap_scan (fat_fs->dirty, i, 1, true);
+		if (i == BITMAP_ERROR) {
+			lock_release (&fat_fs->write_lock);
+			break;
 		}
+		for (cnt = 0; cnt < FAT_SYNC_RUN
+		              && i + cnt < fat_fs->bs.fat_sectors
+		              && bitmap_test (fat_fs->dirty, i + cnt); cnt++)
+			copy_fat_sector (i + cnt, bounce + cnt * DISK_SECTOR_SIZE);
+		bitmap_set_multiple (fat_fs->dirty, i, cnt, false);
+		lock_release (&fat_fs->write_lock);
+
+		disk_write_multiple (filesys_disk, fat_fs->bs.fat_start + i,
+		                     cnt, bounce);
+		fat_fs->sync_cnt += cnt;
+	}
+	lock_release (&fat_fs->sync_lock);
+
+	free (bounce);
+}
+
+/* Prints FAT statistics. */
+void
+fat_print_stats (void) {
+	printf ("FAT: %u sectors, %llu written back\n",
+	        fat_fs->bs.fat_sectors, fat_fs->sync_cnt);
+}
+
+/* FAT flusher thread.  Periodically syncs the FAT, so a crash
+ * loses at most FAT_FLUSH_INTERVAL ticks of allocations. */
+static void
+fat_flusher (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FAT_FLUSH_INTERVAL);
+		fat_sync ();
 	}
 }
 
@@ -123,6 +205,10 @@ fat_create (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_build_maps ();
+
+	// The whole table is new
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -131,7 +217,8 @@ fat_create (void) {
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	buffer_cache_write (cluster_to_sector (ROOT_DIR_CLUSTER), buf,
+	                    0, DISK_SECTOR_SIZE);
 	free (buf);
 }
 
@@ -152,42 +239,255 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	const unsigned int entries_per_sector =
+	    DISK_SECTOR_SIZE / sizeof (cluster_t);
+
+	// Data clusters follow the FAT.  Cluster 0 means "free", so
+	// data cluster N lives at sector data_start + (N - 1) * SPC.
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length =
+	    (fat_fs->bs.total_sectors - fat_fs->data_start)
+	    / SECTORS_PER_CLUSTER + 1;
+	if (fat_fs->fat_length > fat_fs->bs.fat_sectors * entries_per_sector)
+		fat_fs->fat_length = fat_fs->bs.fat_sectors * entries_per_sector;
+	fat_fs->last_clst = fat_fs->fat_length - 1;
+	fat_fs->alloc_hint = ROOT_DIR_CLUSTER + 1;
+	fat_fs->free_map = NULL;
+	fat_fs->dirty = NULL;
+	lock_init (&fat_fs->write_lock);
+	lock_init (&fat_fs->sync_lock);
+}
+
+/* Builds the free-cluster bitmap from the FAT, and an empty
+ * dirty-sector bitmap. */
+static void
+fat_build_maps (void) {
+	cluster_t clst;
+
+	bitmap_destroy (fat_fs->free_map);
+	bitmap_destroy (fat_fs->dirty);
+	fat_fs->free_map = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->free_map == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT free map creation failed");
+	bitmap_mark (fat_fs->free_map, 0);
+	for (clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0)
+			bitmap_mark (fat_fs->free_map, clst);
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets FAT entry CLST to VAL and keeps the free map in step.
+ * Must hold write_lock. */
+static void
+set_entry (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
+	if (fat_fs->free_map != NULL)
+		bitmap_set (fat_fs->free_map, clst, val != 0);
+	if (fat_fs->dirty != NULL)
+		bitmap_mark (fat_fs->dirty,
+		             clst / (DISK_SECTOR_SIZE / sizeof (cluster_t)));
+}
+
+/* Finds CNT free clusters, preferring one contiguous run starting
+ * near HINT, links them into a chain ending in EOChain, and
+ * returns the first.  Returns 0 if there are not enough free
+ * clusters.  Must hold write_lock. */
+static cluster_t
+alloc_clusters (cluster_t hint, size_t cnt) {
+	cluster_t first = 0, prev = 0;
+	size_t got = 0;
+
+	ASSERT (cnt > 0);
+
+	if (hint == 0 || hint >= fat_fs->fat_length)
+		hint = fat_fs->alloc_hint;
+
+	while (got < cnt) {
+		/* Take the longest run we can, down to single clusters. */
+		size_t want = cnt - got, clst = BITMAP_ERROR, i;
+		for (; want > 0; want /= 2) {
+			clst = bitmap_scan_from_hint (fat_fs->free_map, hint, want, false);
+			if (clst != BITMAP_ERROR)
+				break;
+		}
+		if (clst == BITMAP_ERROR) {
+			/* Out of space: undo. */
+			while (first != 0 && first != EOChain) {
+				cluster_t next = fat_fs->fat[first];
+				set_entry (first, 0);
+				first = next;
+			}
+			return 0;
+		}
+
+		for (i = 0; i < want; i++) {
+			set_entry (clst + i, EOChain);
+			if (prev != 0)
+				set_entry (prev, clst + i);
+			else
+				first = clst + i;
+			prev = clst + i;
+		}
+		got += want;
+		hint = clst + want;
+	}
+
+	fat_fs->alloc_hint = hint < fat_fs->fat_length ? hint : 1;
+	return first;
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	return fat_extend_chain (clst, 1);
+}
+
+/* Adds CNT clusters to the chain ending in CLST, or starts a new
+ * chain of CNT clusters if CLST is 0.  The new clusters are
+ * allocated as one contiguous run right after CLST if possible.
+ * Returns the first new cluster, or 0 if there is not enough
+ * space, in which case nothing is allocated. */
+cluster_t
+fat_extend_chain (cluster_t clst, size_t cnt) {
+	cluster_t first;
+
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (clst == 0 || fat_fs->fat[clst] == EOChain);
+	first = alloc_clusters (clst != 0 ? clst + 1 : 0, cnt);
+	if (first != 0 && clst != 0)
+		set_entry (clst, first);
+	lock_release (&fat_fs->write_lock);
+	return first;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		set_entry (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+		set_entry (clst, 0);
+		if (clst < fat_fs->alloc_hint)
+			fat_fs->alloc_hint = clst;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	set_entry (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Returns the cluster that contains sector SECTOR. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Chain cursors                                                              */
+/*----------------------------------------------------------------------------*/
+
+/* Initializes CURSOR for the chain that starts at START. */
+void
+fat_cursor_init (struct fat_cursor *cursor, cluster_t start) {
+	cursor->start = start;
+	cursor->run_idx = 0;
+	cursor->run_clst = 0;
+	cursor->run_len = 0;
+}
+
+/* Makes CURSOR's cached run the one that starts with CLST, at
+ * chain index IDX. */
+static void
+cursor_load_run (struct fat_cursor *cursor, size_t idx, cluster_t clst) {
+	size_t len = 1;
+
+	while (fat_get (clst + len - 1) == clst + len)
+		len++;
+	cursor->run_idx = idx;
+	cursor->run_clst = clst;
+	cursor->run_len = len;
+}
+
+/* Returns the cluster at index IDX of CURSOR's chain, or 0 if
+ * the chain is shorter than that.  Walks the chain a run at a
+ * time, starting from the cached run when IDX lies at or past it,
+ * or from the head otherwise. */
+cluster_t
+fat_cursor_seek (struct fat_cursor *cursor, size_t idx) {
+	if (cursor->start == 0 || cursor->start == EOChain)
+		return 0;
+
+	if (cursor->run_clst == 0 || idx < cursor->run_idx)
+		cursor_load_run (cursor, 0, cursor->start);
+
+	while (idx >= cursor->run_idx + cursor->run_len) {
+		cluster_t last = cursor->run_clst + cursor->run_len - 1;
+		cluster_t next = fat_get (last);
+		if (next == EOChain || next == 0)
+			return 0;
+		cursor_load_run (cursor, cursor->run_idx + cursor->run_len, next);
+	}
+	return cursor->run_clst + (idx - cursor->run_idx);
+}
+
+/* Returns the cluster at index IDX of CURSOR's chain, like
+ * fat_cursor_seek(), but if the chain is shorter than that, first
+ * adds the missing clusters to its end with one call to
+ * fat_extend_chain(), so that they form a single run if there is
+ * room.  Starts the chain if it is empty; the caller must then
+ * save the new CURSOR->start.  Returns 0, leaving the chain as it
+ * was, if there is not enough space.  The caller must keep others
+ * from changing the chain meanwhile. */
+cluster_t
+fat_cursor_extend (struct fat_cursor *cursor, size_t idx) {
+	cluster_t clst = fat_cursor_seek (cursor, idx);
+	size_t len;
+
+	if (clst != 0)
+		return clst;
+
+	if (cursor->start == 0) {
+		clst = fat_extend_chain (0, idx + 1);
+		if (clst == 0)
+			return 0;
+		fat_cursor_init (cursor, clst);
+	} else {
+		/* The failed seek left the chain's last run cached. */
+		len = cursor->run_idx + cursor->run_len;
+		clst = cursor->run_clst + cursor->run_len - 1;
+		if (fat_extend_chain (clst, idx + 1 - len) == 0)
+			return 0;
+	}
+	return fat_cursor_seek (cursor, idx);
 }
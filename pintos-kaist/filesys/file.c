@@ -1,15 +1,42 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/disk.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#if defined (VM) && defined (EFILESYS)
+#include "filesys/page_cache.h"
+
+/* With virtual memory, file data is read and written through
+ * the page cache, which also does the reading ahead. */
+#define file_data_read page_cache_read
+#define file_data_write page_cache_write
+#define file_data_prefetch page_cache_prefetch
+#else
+#define file_data_read inode_read_at
+#define file_data_write inode_write_at
+#define file_data_prefetch inode_prefetch
+#endif
+
+/* Read-ahead window bounds, in bytes.  The window starts at
+ * READAHEAD_MIN on the first sequential read, doubles on each
+ * further one up to READAHEAD_MAX, and collapses on a seek. */
+#define READAHEAD_MIN (4 * DISK_SECTOR_SIZE)
+#define READAHEAD_MAX (32 * DISK_SECTOR_SIZE)
 
 /* An open file. */
 struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+
+	/* Sequential access detection. */
+	off_t ra_next;              /* Offset a sequential read would start at. */
+	off_t ra_end;               /* End of the data already read ahead. */
+	off_t ra_window;            /* Bytes to read ahead, 0 if random. */
 };
 
+static void file_readahead (struct file *, off_t ofs, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
@@ -20,6 +47,9 @@ file_open (struct inode *inode) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->ra_next = 0;
+		file->ra_end = 0;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
@@ -71,7 +101,8 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	off_t bytes_read = file_data_read (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
 	return bytes_read;
 }
@@ -83,19 +114,51 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = file_data_read (file->inode, buffer, size, file_ofs);
+	file_readahead (file, file_ofs, bytes_read);
+	return bytes_read;
+}
+
+/* Updates FILE's read-ahead state after a read of BYTES_READ
+ * bytes at offset OFS, and starts reading ahead if the reads so
+ * far look sequential. */
+static void
+file_readahead (struct file *file, off_t ofs, off_t bytes_read) {
+	off_t end = ofs + bytes_read;
+
+	if (bytes_read == 0)
+		return;
+
+	if (ofs != file->ra_next) {
+		/* Random access: stop reading ahead. */
+		file->ra_window = 0;
+		file->ra_end = end;
+	} else if (file->ra_window == 0)
+		file->ra_window = READAHEAD_MIN;
+	else if (file->ra_window < READAHEAD_MAX)
+		file->ra_window *= 2;
+	file->ra_next = end;
+
+	if (file->ra_window > 0) {
+		off_t start = file->ra_end > end ? file->ra_end : end;
+		off_t stop = end + file->ra_window;
+
+		if (start < stop) {
+			file_data_prefetch (file->inode, stop - start, start);
+			file->ra_end = stop;
+		}
+	}
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at the file's current position.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past end of file grows the file.
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written = file_data_write (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
 	return bytes_written;
 }
@@ -103,14 +166,13 @@ file_write (struct file *file, const void *buffer, off_t size) {
 /* Writes SIZE bytes from BUFFER into FILE,
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually written,
- * which may be less than SIZE if end of file is reached.
- * (Normally we'd grow the file in that case, but file growth is
- * not yet implemented.)
+ * which may be less than SIZE if the disk fills up.
+ * Writing past end of file grows the file.
  * The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
 		off_t file_ofs) {
-	return inode_write_at (file->inode, buffer, size, file_ofs);
+	return file_data_write (file->inode, buffer, size, file_ofs);
 }
 
 /* Prevents write operations on FILE's underlying inode
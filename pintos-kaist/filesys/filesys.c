@@ -6,11 +6,23 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/buffer_cache.h"
+#include "filesys/dcache.h"
 #include "devices/disk.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
+#if defined (VM) && defined (EFILESYS)
+#include "filesys/page_cache.h"
+#endif
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* The root directory, kept open so that its index stays in memory
+ * while every file system call opens and closes it. */
+static struct dir *root_dir;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,7 +33,10 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
 	inode_init ();
+	dir_init ();
+	dcache_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -39,18 +54,27 @@ filesys_init (bool format) {
 
 	free_map_open ();
 #endif
+
+	root_dir = dir_open_root ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
  * to disk. */
 void
 filesys_done (void) {
+	dir_close (root_dir);
+	root_dir = NULL;
+
 	/* Original FS */
 #ifdef EFILESYS
+#ifdef VM
+	page_cache_flush ();
+#endif
 	fat_close ();
 #else
 	free_map_close ();
 #endif
+	buffer_cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -61,12 +85,26 @@ bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
 	struct dir *dir = dir_open_root ();
+#ifdef EFILESYS
+	/* The inode takes a one-cluster chain of its own. */
+	cluster_t inode_clst = dir != NULL ? fat_create_chain (0) : 0;
+	bool success;
+
+	if (inode_clst != 0)
+		inode_sector = cluster_to_sector (inode_clst);
+	success = (inode_clst != 0
+			&& inode_create (inode_sector, initial_size)
+			&& dir_add (dir, name, inode_sector));
+	if (!success && inode_clst != 0)
+		fat_remove_chain (inode_clst, 0);
+#else
 	bool success = (dir != NULL
 			&& free_map_allocate (1, &inode_sector)
 			&& inode_create (inode_sector, initial_size)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
+#endif
 	dir_close (dir);
 
 	return success;
@@ -79,9 +117,14 @@ filesys_create (const char *name, off_t initial_size) {
  * or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name) {
-	struct dir *dir = dir_open_root ();
+	struct dir *dir;
 	struct inode *inode = NULL;
 
+	/* On a dentry cache hit, don't even open the directory. */
+	if (dir_lookup_cached (ROOT_DIR_SECTOR, name, &inode))
+		return file_open (inode);
+
+	dir = dir_open_root ();
 	if (dir != NULL)
 		dir_lookup (dir, name, &inode);
 	dir_close (dir);
@@ -108,8 +151,11 @@ do_format (void) {
 	printf ("Formatting file system...");
 
 #ifdef EFILESYS
-	/* Create FAT and save it to the disk. */
+	/* Create FAT and save it to the disk.  The root directory's
+	 * inode goes in ROOT_DIR_CLUSTER, which fat_create() reserves. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
@@ -1,23 +1,73 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#else
 #include "filesys/free-map.h"
+#endif
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#if defined (VM) && defined (EFILESYS)
+#include "filesys/page_cache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifndef EFILESYS
+/* Block map geometry.  The first DIRECT_CNT data sectors of a
+ * file are named in the inode itself, the next PTRS_PER_SECTOR
+ * in an indirect block, and the rest through a doubly indirect
+ * block: a little over 8 MB in all.  A zero entry means the
+ * sector has not been allocated yet (sector 0 always holds the
+ * free map inode), so files may be sparse. */
+#define DIRECT_CNT 124
+#define PTRS_PER_SECTOR ((off_t) (DISK_SECTOR_SIZE / sizeof (disk_sector_t)))
+#define INDIRECT_START DIRECT_CNT
+#define DOUBLY_START (INDIRECT_START + PTRS_PER_SECTOR)
+#define MAX_SECTORS (DOUBLY_START + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+#endif
+
+/* A data sector that has been allocated but never written carries
+ * the UNWRITTEN mark: it reads as zeros without touching the disk,
+ * and is only zeroed when first partially written, or skipped over
+ * by a write under EFILESYS.  It is never in the buffer cache. */
+#define UNWRITTEN 0x80000000u
+
+/* How byte_to_sector() treats missing and unwritten sectors. */
+enum map_mode {
+	MAP_LOOKUP,                         /* Change nothing. */
+	MAP_CREATE,                         /* Allocate missing sectors. */
+	MAP_WRITE                           /* Also clear the UNWRITTEN mark. */
+};
+
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
+#ifdef EFILESYS
+/* The data live in the FAT chain that starts at START, one sector
+ * per cluster.  Its first WRITTEN sectors have been written; the
+ * rest are allocated but still UNWRITTEN. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	cluster_t start;                    /* First data cluster, 0 if none. */
+	uint32_t written;                   /* Data sectors written so far. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t unused[124];               /* Not used. */
 };
+#else
+struct inode_disk {
+	disk_sector_t direct[DIRECT_CNT];   /* Direct data sectors. */
+	disk_sector_t indirect;             /* Indirect block. */
+	disk_sector_t doubly_indirect;      /* Doubly indirect block. */
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+};
+#endif
 
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
@@ -28,35 +78,304 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+
+	/* Protected by LOCK.  Held while DATA is read in, so openers
+	 * that find the inode early wait until it is ready. */
+	struct lock lock;
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+
+#ifdef EFILESYS
+	/* Where the last access was in the data chain, so that
+	 * sequential access does not walk the chain from its head for
+	 * every sector.  Protected by LOCK. */
+	struct fat_cursor cursor;
+#else
+	/* Copy of the last index block whose entries named data
+	 * sectors, so that sequential access through the indirect
+	 * blocks does not go to the buffer cache for every sector.
+	 * Allocated on first use.  Protected by LOCK. */
+	disk_sector_t index_sector;         /* Cached block, 0 if none. */
+	disk_sector_t *index;               /* Its PTRS_PER_SECTOR entries. */
+#endif
 };
 
+/* A sector of zeros. */
+static char zeros[DISK_SECTOR_SIZE];
+
+/* Writes INODE's on-disk inode back through the buffer cache. */
+static void
+inode_write_disk (struct inode *inode) {
+	buffer_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+}
+
+#ifdef EFILESYS
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, with the UNWRITTEN mark if it has not been written yet.
+ * If INODE's chain does not reach POS and MODE is not MAP_LOOKUP,
+ * extends it that far, allocating the new clusters together.  If
+ * MODE is MAP_WRITE, the caller is about to write the sector, so
+ * it is counted as written, after zeroing any unwritten sectors
+ * before it; the return value still carries the mark.  Returns 0
+ * if there is no sector for POS, or the disk is full.
+ * INODE's lock must be held. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, enum map_mode mode) {
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	cluster_t clst;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+	ASSERT (pos >= 0);
+
+	if (mode == MAP_LOOKUP)
+		clst = fat_cursor_seek (&inode->cursor, idx);
+	else {
+		clst = fat_cursor_extend (&inode->cursor, idx);
+		if (clst != 0 && inode->data.start != inode->cursor.start) {
+			inode->data.start = inode->cursor.start;
+			inode_write_disk (inode);
+		}
+	}
+	if (clst == 0)
+		return 0;
+	if (idx < inode->data.written)
+		return cluster_to_sector (clst);
+
+	if (mode == MAP_WRITE) {
+		/* Sectors skipped over by a write past the written part
+		   count as written from now on, so they must hold zeros.
+		   They go straight to disk: regular file data may be
+		   cached in the page cache, which does its own I/O, and has
+		   no business in the buffer cache. */
+		while (inode->data.written < idx) {
+			cluster_t skipped = fat_cursor_seek (&inode->cursor,
+					inode->data.written++);
+			disk_write (filesys_disk, cluster_to_sector (skipped), zeros);
+		}
+		inode->data.written = idx + 1;
+		inode_write_disk (inode);
+	}
+	return cluster_to_sector (clst) | UNWRITTEN;
+}
+
+/* Releases every data sector of INODE, but not the inode's own
+ * sector.  Cached copies of the written ones are dropped first,
+ * so that they are not written back over whatever the sectors
+ * hold next. */
+static void
+free_blocks (struct inode *inode) {
+	size_t idx;
+
+	if (inode->data.start == 0)
+		return;
+	for (idx = 0; idx < inode->data.written; idx++)
+		buffer_cache_discard (cluster_to_sector (
+					fat_cursor_seek (&inode->cursor, idx)));
+	fat_remove_chain (inode->data.start, 0);
+}
+#else
+/* Allocates a sector and stores it into *SECTORP.  A DATA sector
+ * is only marked UNWRITTEN; an index block is filled with zeros.
+ * Returns true if successful, false if the disk is full. */
+static bool
+alloc_sector (disk_sector_t *sectorp, bool data) {
+	if (!free_map_allocate (1, sectorp))
+		return false;
+	ASSERT ((*sectorp & UNWRITTEN) == 0);
+	if (data)
+		*sectorp |= UNWRITTEN;
+	else
+		buffer_cache_write (*sectorp, zeros, 0, DISK_SECTOR_SIZE);
+	return true;
+}
+
+/* Applies MODE to block pointer *ENTRY, which names a DATA sector
+ * or an index block: allocates a sector for it if it is empty and
+ * MODE is not MAP_LOOKUP, and clears its UNWRITTEN mark if MODE
+ * is MAP_WRITE.  Returns the entry's old value, or its new one if
+ * it was empty.  Sets *CHANGED to true if *ENTRY changed. */
+static disk_sector_t
+map_entry (disk_sector_t *entry, enum map_mode mode, bool data,
+		bool *changed) {
+	disk_sector_t old;
+
+	if (*entry == 0 && mode != MAP_LOOKUP && alloc_sector (entry, data))
+		*changed = true;
+	old = *entry;
+	if (mode == MAP_WRITE && (*entry & UNWRITTEN)) {
+		*entry &= ~UNWRITTEN;
+		*changed = true;
+	}
+	return old;
+}
+
+/* Applies MODE, as in map_entry(), to *SLOT, a block pointer
+ * within INODE's on-disk inode.  Returns 0 if the slot stays
+ * empty. */
+static disk_sector_t
+inode_slot (struct inode *inode, disk_sector_t *slot, enum map_mode mode,
+		bool data) {
+	bool changed = false;
+	disk_sector_t sector = map_entry (slot, mode, data, &changed);
+
+	if (changed)
+		inode_write_disk (inode);
+	return sector;
+}
+
+/* Applies MODE, as in map_entry(), to entry I of index block
+ * BLOCK in INODE.  Returns 0 if the entry stays empty.  If LEAF
+ * is true, BLOCK's entries are data sectors, and BLOCK is kept in
+ * INODE's index cache. */
+static disk_sector_t
+index_entry (struct inode *inode, disk_sector_t block, off_t i,
+		enum map_mode mode, bool leaf) {
+	disk_sector_t sector, old;
+	bool cached = false, changed = false;
+
+	ASSERT (i < PTRS_PER_SECTOR);
+
+	if (leaf) {
+		if (inode->index == NULL)
+			inode->index = malloc (DISK_SECTOR_SIZE);
+		if (inode->index != NULL) {
+			if (inode->index_sector != block) {
+				buffer_cache_read (block, inode->index, 0, DISK_SECTOR_SIZE);
+				inode->index_sector = block;
+			}
+			cached = true;
+		}
+	}
+
+	if (cached)
+		sector = inode->index[i];
 	else
-		return -1;
+		buffer_cache_read (block, &sector, i * sizeof sector, sizeof sector);
+
+	old = map_entry (&sector, mode, leaf, &changed);
+	if (changed) {
+		buffer_cache_write (block, &sector, i * sizeof sector, sizeof sector);
+		if (cached)
+			inode->index[i] = sector;
+	}
+	return old;
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, possibly with the UNWRITTEN mark.  If that part of INODE
+ * has no sector yet and MODE is not MAP_LOOKUP, allocates one,
+ * along with any index blocks needed to reach it.  If MODE is
+ * MAP_WRITE, the caller is about to write the sector, so its
+ * UNWRITTEN mark is cleared; the return value still carries it.
+ * Returns 0 if there is no sector for POS: it lies in a hole, or
+ * is past the largest possible file, or the disk is full.
+ * INODE's lock must be held. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, enum map_mode mode) {
+	off_t idx = pos / DISK_SECTOR_SIZE;
+	disk_sector_t block;
+
+	ASSERT (inode != NULL);
+	ASSERT (lock_held_by_current_thread (&inode->lock));
+	ASSERT (pos >= 0);
+
+	if (idx < INDIRECT_START)
+		return inode_slot (inode, &inode->data.direct[idx], mode, true);
+
+	if (idx < DOUBLY_START) {
+		block = inode_slot (inode, &inode->data.indirect, mode, false);
+		if (block == 0)
+			return 0;
+		return index_entry (inode, block, idx - INDIRECT_START, mode, true);
+	}
+
+	if (idx < MAX_SECTORS) {
+		idx -= DOUBLY_START;
+		block = inode_slot (inode, &inode->data.doubly_indirect, mode, false);
+		if (block == 0)
+			return 0;
+		block = index_entry (inode, block, idx / PTRS_PER_SECTOR, mode, false);
+		if (block == 0)
+			return 0;
+		return index_entry (inode, block, idx % PTRS_PER_SECTOR, mode, true);
+	}
+
+	return 0;
+}
+
+/* Releases the sectors named in index block BLOCK, then BLOCK
+ * itself.  LEVEL is 1 for an indirect block, 2 for a doubly
+ * indirect block. */
+static void
+free_index (disk_sector_t block, int level) {
+	disk_sector_t *ptrs = malloc (DISK_SECTOR_SIZE);
+	off_t i;
+
+	if (ptrs != NULL) {
+		buffer_cache_read (block, ptrs, 0, DISK_SECTOR_SIZE);
+		for (i = 0; i < PTRS_PER_SECTOR; i++)
+			if (ptrs[i] != 0) {
+				if (level > 1)
+					free_index (ptrs[i], level - 1);
+				else
+					free_map_release (ptrs[i] & ~UNWRITTEN, 1);
+			}
+		free (ptrs);
+	}
+	free_map_release (block, 1);
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Releases every data and index sector of INODE, but not the
+ * inode's own sector. */
+static void
+free_blocks (struct inode *inode) {
+	off_t i;
+
+	for (i = 0; i < DIRECT_CNT; i++)
+		if (inode->data.direct[i] != 0)
+			free_map_release (inode->data.direct[i] & ~UNWRITTEN, 1);
+	if (inode->data.indirect != 0)
+		free_index (inode->data.indirect, 1);
+	if (inode->data.doubly_indirect != 0)
+		free_index (inode->data.doubly_indirect, 2);
+}
+#endif
+
+/* Open inodes, hashed by sector, so that opening a single inode
+ * twice returns the same `struct inode'.  OPEN_INODES_LOCK
+ * protects the table and every inode's OPEN_CNT.  It is never held
+ * across disk I/O.  An inode whose last opener is closing it stays
+ * in the table with OPEN_CNT 0 until it is gone; INODE_CLOSED is
+ * signaled then. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_closed;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("open inode table creation failed");
+	lock_init (&open_inodes_lock);
+	cond_init (&inode_closed);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -67,7 +386,8 @@ inode_init (void) {
 bool
 inode_create (disk_sector_t sector, off_t length) {
 	struct inode_disk *disk_inode = NULL;
-	bool success = false;
+	struct inode *inode;
+	bool success = true;
 
 	ASSERT (length >= 0);
 
@@ -75,24 +395,49 @@ inode_create (disk_sector_t sector, off_t length) {
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+#ifndef EFILESYS
+	if (bytes_to_sectors (length) > MAX_SECTORS)
+		return false;
+#endif
+
+	/* Write an empty inode, then allocate sectors for LENGTH bytes.
+	 * They are only marked unwritten, not zeroed. */
 	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
+	if (disk_inode == NULL)
+		return false;
+	disk_inode->length = 0;
+	disk_inode->magic = INODE_MAGIC;
+	buffer_cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
+	free (disk_inode);
+
+	inode = inode_open (sector);
+	if (inode == NULL)
+		return false;
+
+	lock_acquire (&inode->lock);
+#ifdef EFILESYS
+	/* Mapping the last sector allocates the whole chain at once.
+	 * On failure, nothing is allocated. */
+	if (length > 0 && byte_to_sector (inode, length - 1, MAP_CREATE) == 0)
+		success = false;
+#else
+	for (size_t i = 0; i < bytes_to_sectors (length); i++)
+		if (byte_to_sector (inode, i * DISK_SECTOR_SIZE, MAP_CREATE) == 0) {
+			success = false;
+			break;
+		}
+	if (!success) {
+		free_blocks (inode);
+		memset (inode->data.direct, 0, sizeof inode->data.direct);
+		inode->data.indirect = inode->data.doubly_indirect = 0;
 	}
+#endif
+	if (success)
+		inode->data.length = length;
+	inode_write_disk (inode);
+	lock_release (&inode->lock);
+	inode_close (inode);
+
 	return success;
 }
 
@@ -101,39 +446,66 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct inode key;
+	struct hash_elem *e;
 	struct inode *inode;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
+	/* Check whether this inode is already open.  If it is being
+	 * closed, wait until it is gone and read it in anew. */
+	key.sector = sector;
+	lock_acquire (&open_inodes_lock);
+	while ((e = hash_find (&open_inodes, &key.elem)) != NULL) {
+		inode = hash_entry (e, struct inode, elem);
+		if (inode->open_cnt == 0) {
+			cond_wait (&inode_closed, &open_inodes_lock);
+			continue;
 		}
+		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+
+		/* Wait for the opener that is reading it in, if any. */
+		lock_acquire (&inode->lock);
+		lock_release (&inode->lock);
+		return inode;
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	/* Initialize, and publish the inode before reading it in. */
 	inode->sector = sector;
 	inode->open_cnt = 1;
+	lock_init (&inode->lock);
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+#ifndef EFILESYS
+	inode->index_sector = 0;
+	inode->index = NULL;
+#endif
+	lock_acquire (&inode->lock);
+	hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+#ifdef EFILESYS
+	fat_cursor_init (&inode->cursor, inode->data.start);
+#endif
+	lock_release (&inode->lock);
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -148,22 +520,47 @@ inode_get_inumber (const struct inode *inode) {
  * If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) {
+	bool last;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	last = --inode->open_cnt == 0;
+#if defined (VM) && defined (EFILESYS)
+	if (last) {
+		/* Write back and drop cached data, which takes disk I/O, so
+		   not under the lock.  Meanwhile the inode stays in the
+		   table, and anyone opening it anew waits for it to go
+		   instead of reading stale data from disk. */
+		lock_release (&open_inodes_lock);
+		page_cache_release (inode);
+		lock_acquire (&open_inodes_lock);
+	}
+#endif
+	if (last) {
+		hash_delete (&open_inodes, &inode->elem);
+		cond_broadcast (&inode_closed, &open_inodes_lock);
+	}
+	lock_release (&open_inodes_lock);
 
+	if (last) {
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
+			free_blocks (inode);
+			buffer_cache_discard (inode->sector);
+#ifdef EFILESYS
+			fat_remove_chain (sector_to_cluster (inode->sector), 0);
+#else
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+#endif
 		}
 
+#ifndef EFILESYS
+		free (inode->index);
+#endif
 		free (inode); 
 	}
 }
@@ -173,7 +570,9 @@ inode_close (struct inode *inode) {
 void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
+	lock_acquire (&inode->lock);
 	inode->removed = true;
+	lock_release (&inode->lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -183,11 +582,10 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -200,89 +598,154 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, MAP_LOOKUP);
+		lock_release (&inode->lock);
+
+		/* Holes and unwritten sectors read as zeros. */
+		if (sector_idx != 0 && !(sector_idx & UNWRITTEN))
+			buffer_cache_read (sector_idx, buffer + bytes_read,
+					sector_ofs, chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Asks the buffer cache to read ahead the sectors that hold the
+ * SIZE bytes of INODE starting at OFFSET, without waiting for
+ * them.  Bytes past the end of INODE are ignored. */
+void
+inode_prefetch (struct inode *inode, off_t size, off_t offset) {
+	off_t end = offset + size;
+
+	if (end > inode_length (inode))
+		end = inode_length (inode);
+	offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE);
+	for (; offset < end; offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector;
+
+		lock_acquire (&inode->lock);
+		sector = byte_to_sector (inode, offset, MAP_LOOKUP);
+		lock_release (&inode->lock);
+		if (sector != 0 && !(sector & UNWRITTEN))
+			buffer_cache_prefetch (sector);
+	}
+}
+
+/* Returns the disk sector that holds byte offset POS within
+ * INODE, for callers that do their own I/O instead of going
+ * through the buffer cache, like the page cache.  Returns 0 if
+ * the sector reads as zeros: it is a hole or was never written.
+ * If WRITE is true, the caller is about to write the whole sector,
+ * so it is allocated if need be and counted as written; then 0
+ * means the disk is full. */
+disk_sector_t
+inode_data_sector (struct inode *inode, off_t pos, bool write) {
+	disk_sector_t sector;
+
+	lock_acquire (&inode->lock);
+	sector = byte_to_sector (inode, pos, write ? MAP_WRITE : MAP_LOOKUP);
+	lock_release (&inode->lock);
+	if (!write && (sector & UNWRITTEN))
+		return 0;
+	return sector & ~UNWRITTEN;
+}
+
+/* Extends INODE to LENGTH bytes, if it is shorter, allocating
+ * sectors for the new bytes, which read as zeros until written.
+ * For callers that write the data on their own and must make the
+ * new length visible only once the data can be read back.
+ * Returns false if writes are denied or the disk is full. */
+bool
+inode_grow (struct inode *inode, off_t length) {
+	bool success = true;
+
+	lock_acquire (&inode->lock);
+	if (length > inode->data.length) {
+		if (inode->deny_write_cnt
+				|| byte_to_sector (inode, length - 1, MAP_CREATE) == 0)
+			success = false;
+		else {
+			inode->data.length = length;
+			inode_write_disk (inode);
+		}
+	}
+	lock_release (&inode->lock);
+	return success;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk fills up or the maximum file size
+ * is reached.  A write past end of file extends the inode;
+ * bytes between the old end and OFFSET read as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
-		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		/* Bytes left in sector, and the number of bytes to actually
+		   write into it. */
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-		int min_left = inode_left < sector_left ? inode_left : sector_left;
+		int chunk_size = size < sector_left ? size : sector_left;
 
-		/* Number of bytes to actually write into this sector. */
-		int chunk_size = size < min_left ? size : min_left;
-		if (chunk_size <= 0)
+		/* Find or allocate the sector. */
+		lock_acquire (&inode->lock);
+		sector_idx = byte_to_sector (inode, offset, MAP_WRITE);
+		if (sector_idx == 0) {
+			lock_release (&inode->lock);
 			break;
+		}
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+		if (sector_idx & UNWRITTEN) {
+			/* First write to this sector.  Its old contents on disk
+			   are garbage, so zero it in the cache unless the chunk
+			   covers all of it, and write it before dropping the
+			   lock, so that no reader sees the garbage. */
+			sector_idx &= ~UNWRITTEN;
+			if (chunk_size < DISK_SECTOR_SIZE)
+				buffer_cache_write (sector_idx, zeros, 0, DISK_SECTOR_SIZE);
+			buffer_cache_write (sector_idx, buffer + bytes_written,
+					sector_ofs, chunk_size);
+			lock_release (&inode->lock);
 		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+			/* The cache only reads the sector in first if the chunk
+			   does not cover all of it. */
+			lock_release (&inode->lock);
+			buffer_cache_write (sector_idx, buffer + bytes_written,
+					sector_ofs, chunk_size);
+		}
 
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+		/* Extend the file once the data is in place, so readers
+		   never see uninitialized bytes. */
+		lock_acquire (&inode->lock);
+		if (offset + chunk_size > inode->data.length) {
+			inode->data.length = offset + chunk_size;
+			inode_write_disk (inode);
 		}
+		lock_release (&inode->lock);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_written;
 }
@@ -292,8 +755,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	void
 inode_deny_write (struct inode *inode) 
 {
+#if defined (VM) && defined (EFILESYS)
+	/* Writes made before now must still reach the inode. */
+	page_cache_sync (inode);
+#endif
+	lock_acquire (&inode->lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,9 +770,17 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	lock_acquire (&inode->lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	lock_release (&inode->lock);
+}
+
+/* Returns true if writes to INODE are denied. */
+bool
+inode_write_denied (const struct inode *inode) {
+	return inode->deny_write_cnt > 0;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
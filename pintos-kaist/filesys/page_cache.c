@@ -1,9 +1,94 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
 #include "vm/vm.h"
+
+/* struct page only has a page_cache member in the extended file
+   system, and the page cache keeps its frames in the VM frame
+   table, so it only exists when both are built.  None of the
+   shipped configurations does that: filesys/ builds without VM,
+   and vm/ without EFILESYS.  Enabling VM in filesys/Make.vars
+   builds it. */
+#if defined (VM) && defined (EFILESYS)
+#include <debug.h>
+#include <round.h>
+#include <stddef.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* File data is cached a page at a time, in struct pages of type
+   VM_PAGE_CACHE.  file_read() and file_write() go through the
+   cache, and nothing else does.  mmap() is not implemented yet
+   (see vm/file.c), so no mapping shares these pages, and the
+   read-only program text that vm.c shares between processes is
+   another copy of the same file data.  Pages are read from and
+   written to the disk directly, a run of consecutive sectors at a
+   time, not through the buffer cache, which is left with metadata
+   and directories.
+
+   Each page's frame is in the VM frame table, so cached data
+   compete for memory with user pages; the frame table may evict
+   an unpinned page through swap_out(), which writes it back and
+   takes it out of the cache.  The cache also holds at most
+   PAGE_CACHE_SIZE pages, and past that replaces the least
+   recently used unpinned page.  Writes only dirty the cached
+   page.  A write past end of file grows the inode while holding
+   the page, so readers that see the new length wait for the
+   data.
+
+   Dirty pages reach the disk when they are replaced or evicted,
+   when their inode is synced or released, and from the kworkerd
+   worker thread.  kworkerd writes them back once DIRTY_THRESHOLD
+   of them pile up or, checked whenever the cache is used, once
+   the oldest has been dirty for WRITEBACK_INTERVAL.  It also
+   reads in the pages queued by page_cache_prefetch().
+
+   Pages do not hold a reference to their inode.  Instead,
+   inode_close() calls page_cache_release() before an inode goes
+   away.
+
+   PC_LOCK protects the table, the LRU list, the counters, the
+   prefetch queue, and each page's PIN_CNT, DIRTY, EVICTING and
+   ACCESSED.  A page's own lock protects LOADED and its data, and
+   is only taken by the page's pinners.  A pinned page is never
+   replaced or evicted.  No disk I/O happens under PC_LOCK: a page
+   being written back is either pinned and locked, or EVICTING,
+   in which case it stays in the table so that lookups wait for it
+   to go instead of reading stale data from disk.  PC_LOCK is not
+   held when calling into the frame table either, since the frame
+   table calls back in here. */
+
+/* Most pages in the cache. */
+#ifndef PAGE_CACHE_SIZE
+#define PAGE_CACHE_SIZE 64
+#endif
+
+/* Number of dirty pages that wakes up kworkerd. */
+#define DIRTY_THRESHOLD (PAGE_CACHE_SIZE / 2)
+
+/* Ticks a page may stay dirty before kworkerd is woken up. */
+#define WRITEBACK_INTERVAL (TIMER_FREQ * 5)
+
+/* Most pages waiting to be read ahead.  Requests beyond this
+   are dropped. */
+#define PREFETCH_QUEUE_SIZE 32
+
+/* Sectors in a page. */
+#define PAGE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Returns the page that embeds page cache data PC. */
+#define pc_to_page(PC) \
+	((struct page *) ((uint8_t *) (PC) - offsetof (struct page, page_cache)))
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,36 +100,686 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* A page queued for read-ahead. */
+struct prefetch_request {
+	struct inode *inode;
+	off_t offset;
+};
+
+static struct hash pages;               /* Cached pages by inode and offset. */
+static struct list lru;                 /* Cached pages, least recent first. */
+static size_t page_cnt;                 /* Pages cached or being added,
+                                           not counting EVICTING ones. */
+static size_t dirty_cnt;                /* Number of dirty pages. */
+static int64_t dirty_since;             /* When the oldest page got dirty. */
+static bool writeback_requested;        /* Should kworkerd write back? */
+static struct lock pc_lock;
+static struct condition page_released;  /* Some page's PIN_CNT hit 0, a
+                                           page left the cache, or a
+                                           read-ahead finished. */
+static struct condition work_pending;   /* kworkerd has something to do. */
+
+static struct prefetch_request prefetch_queue[PREFETCH_QUEUE_SIZE];
+static size_t prefetch_head, prefetch_cnt;
+static struct inode *prefetch_inode;    /* Inode kworkerd is reading ahead. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static struct page *page_lookup (struct inode *, off_t offset);
+static void page_insert (struct page *, struct inode *, off_t offset);
+static struct page *page_alloc (void);
+static void page_discard (struct page *);
+static struct page *page_victim (void);
+static void page_remove (struct page *);
+static void page_drop (struct page *);
+static void page_unlink (struct page_cache *);
+static void page_unpin (struct page_cache *);
+static void page_clean (struct page *);
+static void page_io (struct page *, bool write);
+static void flush_pages (struct inode *, bool drop);
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	hash_init (&pages, page_hash, page_less, NULL);
+	list_init (&lru);
+	lock_init (&pc_lock);
+	cond_init (&page_released);
+	cond_init (&work_pending);
+
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR)
+		PANIC ("page cache: cannot start kworkerd");
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	struct page_cache *pc = &page->page_cache;
+
 	/* Set up the handler */
 	page->operations = &page_cache_op;
 
+	pc->inode = NULL;
+	pc->offset = 0;
+	pc->pin_cnt = 0;
+	pc->loaded = false;
+	pc->dirty = false;
+	pc->evicting = false;
+	pc->accessed = false;
+	lock_init (&pc->lock);
+	return true;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, through the page cache.  Returns the number of bytes
+   actually read, which may be less than SIZE if end of file is
+   reached or no page can be had. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+
+	while (size > 0) {
+		/* Bytes left in inode, bytes left in page, lesser of the two. */
+		off_t page_ofs = offset % PGSIZE;
+		off_t inode_left = inode_length (inode) - offset;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t min_left = inode_left < page_left ? inode_left : page_left;
+
+		/* Number of bytes to actually copy out of this page. */
+		off_t chunk_size = size < min_left ? size : min_left;
+		struct page *page;
+
+		if (chunk_size <= 0)
+			break;
+
+		page = page_cache_get (inode, offset - page_ofs);
+		if (page == NULL)
+			break;
+		memcpy (buffer + bytes_read, (uint8_t *) page->frame->kva + page_ofs,
+				chunk_size);
+		page_cache_put (page, false);
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   through the page cache.  Returns the number of bytes actually
+   written, which may be less than SIZE if no page can be had, or
+   end of file is reached and the disk fills up or writes to INODE
+   are denied. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	if (inode_write_denied (inode))
+		return 0;
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t page_left = PGSIZE - page_ofs;
+		off_t chunk_size = size < page_left ? size : page_left;
+		struct page *page;
+		bool grown;
+
+		page = page_cache_get (inode, offset - page_ofs);
+		if (page == NULL)
+			break;
+
+		/* Past end of file, the inode grows first.  Readers that
+		   see the new length wait for the page, so they never see
+		   the data before it is there. */
+		grown = inode_grow (inode, offset + chunk_size);
+		if (grown)
+			memcpy ((uint8_t *) page->frame->kva + page_ofs,
+					buffer + bytes_written, chunk_size);
+		page_cache_put (page, grown);
+		if (!grown)
+			break;
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	return bytes_written;
+}
+
+/* Queues the pages of INODE that hold the SIZE bytes starting at
+   OFFSET to be read in by kworkerd, as far as they lie within
+   the file and are not cached yet. */
+void
+page_cache_prefetch (struct inode *inode, off_t size, off_t offset) {
+	off_t length = inode_length (inode);
+	off_t end = offset + size < length ? offset + size : length;
+
+	lock_acquire (&pc_lock);
+	for (offset -= offset % PGSIZE; offset < end; offset += PGSIZE) {
+		struct page_cache key;
+		struct prefetch_request *r;
+
+		if (prefetch_cnt == PREFETCH_QUEUE_SIZE)
+			break;
+		key.inode = inode;
+		key.offset = offset;
+		if (hash_find (&pages, &key.elem) != NULL)
+			continue;
+
+		r = &prefetch_queue[(prefetch_head + prefetch_cnt++)
+			% PREFETCH_QUEUE_SIZE];
+		r->inode = inode;
+		r->offset = offset;
+		cond_signal (&work_pending, &pc_lock);
+	}
+	lock_release (&pc_lock);
+}
+
+/* Returns the page that caches the data at page-aligned OFFSET
+   in INODE, reading it in if necessary.  The page is pinned and
+   locked for the caller, who may use the data at its frame's KVA
+   and must release it with page_cache_put().  Returns a null
+   pointer if no page can be had. */
+struct page *
+page_cache_get (struct inode *inode, off_t offset) {
+	struct page *page, *fresh = NULL;
+
+	ASSERT (offset % PGSIZE == 0);
+
+	lock_acquire (&pc_lock);
+	while ((page = page_lookup (inode, offset)) == NULL) {
+		if (fresh != NULL) {
+			page_insert (fresh, inode, offset);
+			page = fresh;
+			fresh = NULL;
+			break;
+		}
+
+		/* Getting a page may take disk I/O, so do it without
+		   PC_LOCK, then look again. */
+		lock_release (&pc_lock);
+		fresh = page_alloc ();
+		lock_acquire (&pc_lock);
+		if (fresh == NULL)
+			break;
+	}
+	lock_release (&pc_lock);
+
+	/* Someone else cached the data meanwhile. */
+	if (fresh != NULL)
+		page_discard (fresh);
+	if (page == NULL)
+		return NULL;
+
+	lock_acquire (&page->page_cache.lock);
+	if (!page->page_cache.loaded)
+		swap_in (page, page->frame->kva);
+	return page;
+}
+
+/* Releases PAGE, obtained from page_cache_get().  DIRTY says
+   whether the caller modified its data. */
+void
+page_cache_put (struct page *page, bool dirty) {
+	struct page_cache *pc = &page->page_cache;
+
+	lock_acquire (&pc_lock);
+	if (dirty && !pc->dirty) {
+		pc->dirty = true;
+		if (dirty_cnt++ == 0)
+			dirty_since = timer_ticks ();
+	}
+	lock_release (&pc->lock);
+	page_unpin (pc);
+
+	if (!writeback_requested && dirty_cnt > 0
+			&& (dirty_cnt >= DIRTY_THRESHOLD
+				|| timer_elapsed (dirty_since) >= WRITEBACK_INTERVAL)) {
+		writeback_requested = true;
+		cond_signal (&work_pending, &pc_lock);
+	}
+	lock_release (&pc_lock);
+}
+
+/* Writes the dirty cached pages of INODE back to disk. */
+void
+page_cache_sync (struct inode *inode) {
+	flush_pages (inode, false);
+}
+
+/* Writes back and drops every cached page of INODE, which is
+   about to be closed for the last time. */
+void
+page_cache_release (struct inode *inode) {
+	size_t i, cnt;
+
+	lock_acquire (&pc_lock);
+
+	/* Forget pending read-ahead of INODE, and wait out the one in
+	   progress, if any. */
+	cnt = prefetch_cnt;
+	prefetch_cnt = 0;
+	for (i = 0; i < cnt; i++) {
+		struct prefetch_request r =
+			prefetch_queue[(prefetch_head + i) % PREFETCH_QUEUE_SIZE];
+		if (r.inode != inode)
+			prefetch_queue[(prefetch_head + prefetch_cnt++)
+				% PREFETCH_QUEUE_SIZE] = r;
+	}
+	while (prefetch_inode == inode)
+		cond_wait (&page_released, &pc_lock);
+	lock_release (&pc_lock);
+
+	flush_pages (inode, true);
+}
+
+/* Writes every dirty cached page back to disk. */
+void
+page_cache_flush (void) {
+	flush_pages (NULL, false);
+}
+
+/* Returns true if PAGE was used since the frame table last asked,
+   and forgets that it was.  Called with the frame table locked. */
+bool
+page_cache_test_accessed (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+	bool accessed;
+
+	lock_acquire (&pc_lock);
+	accessed = pc->accessed;
+	pc->accessed = false;
+	lock_release (&pc_lock);
+	return accessed;
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
-page_cache_readahead (struct page *page, void *kva) {
+page_cache_readahead (struct page *page, void *kva UNUSED) {
+	page_io (page, false);
+	page->page_cache.loaded = true;
+	return true;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Utilze the Swap out mechanism to implement writeback.  The
+   frame table calls this to evict PAGE: it is written back if it
+   is dirty and taken out of the cache, and the frame table frees
+   it.  Refuses if PAGE is in use or already on its way out. */
 static bool
 page_cache_writeback (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+
+	lock_acquire (&pc_lock);
+	if (pc->pin_cnt > 0 || pc->evicting) {
+		lock_release (&pc_lock);
+		return false;
+	}
+	pc->evicting = true;
+	page_cnt--;
+	lock_release (&pc_lock);
+
+	page_remove (page);
+	return true;
 }
 
-/* Destory the page_cache. */
+/* Destory the page_cache.  Its frame belongs to the frame
+   table, which frees it. */
 static void
-page_cache_destroy (struct page *page) {
+page_cache_destroy (struct page *page UNUSED) {
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	lock_acquire (&pc_lock);
+	for (;;) {
+		while (prefetch_cnt == 0 && !writeback_requested)
+			cond_wait (&work_pending, &pc_lock);
+
+		if (writeback_requested) {
+			lock_release (&pc_lock);
+			flush_pages (NULL, false);
+			lock_acquire (&pc_lock);
+			writeback_requested = false;
+			dirty_since = timer_ticks ();
+		}
+
+		while (prefetch_cnt > 0) {
+			struct prefetch_request r = prefetch_queue[prefetch_head];
+			struct page *page;
+
+			prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+			prefetch_cnt--;
+
+			/* page_cache_release() waits for PREFETCH_INODE, so
+			   R.INODE stays around while it is read. */
+			prefetch_inode = r.inode;
+			lock_release (&pc_lock);
+			page = page_cache_get (r.inode, r.offset);
+			if (page != NULL)
+				page_cache_put (page, false);
+			lock_acquire (&pc_lock);
+			prefetch_inode = NULL;
+			cond_broadcast (&page_released, &pc_lock);
+		}
+	}
+}
+
+/* Returns the cached page for OFFSET in INODE, pinned, or a null
+   pointer if it is not cached.  If the page is on its way out,
+   waits until it is gone.  The caller must hold pc_lock. */
+static struct page *
+page_lookup (struct inode *inode, off_t offset) {
+	struct page_cache key, *pc;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.offset = offset;
+	for (;;) {
+		e = hash_find (&pages, &key.elem);
+		if (e == NULL)
+			return NULL;
+		pc = hash_entry (e, struct page_cache, elem);
+		if (!pc->evicting)
+			break;
+		cond_wait (&page_released, &pc_lock);
+	}
+
+	pc->pin_cnt++;
+	pc->accessed = true;
+	list_remove (&pc->lru_elem);
+	list_push_back (&lru, &pc->lru_elem);
+	return pc_to_page (pc);
+}
+
+/* Enters PAGE, fresh from page_alloc(), into the cache for OFFSET
+   in INODE, not loaded yet.  The caller must hold pc_lock. */
+static void
+page_insert (struct page *page, struct inode *inode, off_t offset) {
+	struct page_cache *pc = &page->page_cache;
+
+	ASSERT (pc->pin_cnt == 1);
+
+	pc->inode = inode;
+	pc->offset = offset;
+	pc->accessed = true;
+	hash_insert (&pages, &pc->elem);
+	list_push_back (&lru, &pc->lru_elem);
+}
+
+/* Returns a new page with a frame, pinned but not in the cache
+   yet, replacing the least recently used page if the cache is
+   full.  Returns a null pointer if no page can be had.  Must not
+   be called with pc_lock held. */
+static struct page *
+page_alloc (void) {
+	struct page *page, *victim = NULL;
+
+	lock_acquire (&pc_lock);
+	while (page_cnt >= PAGE_CACHE_SIZE
+			&& (victim = page_victim ()) == NULL)
+		cond_wait (&page_released, &pc_lock);
+	page_cnt++;
+	lock_release (&pc_lock);
+
+	if (victim != NULL) {
+		page_remove (victim);
+		vm_free_cache_page (victim);
+	}
+
+	page = malloc (sizeof *page);
+	if (page != NULL) {
+		page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+		page->va = NULL;
+		page->frame = NULL;
+		page->owner = NULL;
+		page->text.inode = NULL;
+		page->writable = false;
+		page->page_cache.pin_cnt = 1;
+		if (vm_claim_cache_page (page))
+			return page;
+		free (page);
+	}
+
+	lock_acquire (&pc_lock);
+	page_cnt--;
+	cond_broadcast (&page_released, &pc_lock);
+	lock_release (&pc_lock);
+	return NULL;
+}
+
+/* Frees PAGE, fresh from page_alloc() but not needed after all. */
+static void
+page_discard (struct page *page) {
+	lock_acquire (&pc_lock);
+	page_cnt--;
+	cond_broadcast (&page_released, &pc_lock);
+	lock_release (&pc_lock);
+	vm_free_cache_page (page);
+}
+
+/* Picks the least recently used page that is neither pinned nor
+   on its way out, and marks it EVICTING.  Returns a null pointer
+   if there is none.  The caller must hold pc_lock, and must pass
+   the page to page_remove(). */
+static struct page *
+page_victim (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&lru); e != list_end (&lru); e = list_next (e)) {
+		struct page_cache *pc = list_entry (e, struct page_cache, lru_elem);
+
+		if (pc->pin_cnt == 0 && !pc->evicting) {
+			pc->evicting = true;
+			page_cnt--;
+			return pc_to_page (pc);
+		}
+	}
+	return NULL;
+}
+
+/* Writes back PAGE, which is EVICTING, if it is dirty, then takes
+   it out of the cache.  Nobody else touches an EVICTING page, so
+   this needs no lock but for the last step.  Must not be called
+   with pc_lock held. */
+static void
+page_remove (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+
+	ASSERT (pc->evicting && pc->pin_cnt == 0);
+
+	if (pc->dirty)
+		page_io (page, true);
+
+	lock_acquire (&pc_lock);
+	if (pc->dirty) {
+		pc->dirty = false;
+		dirty_cnt--;
+	}
+	page_unlink (pc);
+	lock_release (&pc_lock);
+}
+
+/* Takes PAGE, which the caller has pinned and written back, out of
+   the cache once nobody else uses it, and frees it.  Must not be
+   called with pc_lock held. */
+static void
+page_drop (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+
+	lock_acquire (&pc_lock);
+	while (pc->pin_cnt > 1)
+		cond_wait (&page_released, &pc_lock);
+	ASSERT (!pc->dirty);
+
+	/* Still pinned, and EVICTING, so the frame table leaves it
+	   alone until it is freed. */
+	pc->evicting = true;
+	page_cnt--;
+	page_unlink (pc);
+	lock_release (&pc_lock);
+
+	vm_free_cache_page (page);
+}
+
+/* Takes PC out of the table and the LRU list.  The caller must
+   hold pc_lock. */
+static void
+page_unlink (struct page_cache *pc) {
+	hash_delete (&pages, &pc->elem);
+	list_remove (&pc->lru_elem);
+	cond_broadcast (&page_released, &pc_lock);
+}
+
+/* Drops a pin on PC.  The caller must hold pc_lock. */
+static void
+page_unpin (struct page_cache *pc) {
+	ASSERT (pc->pin_cnt > 0);
+	if (--pc->pin_cnt == 0)
+		cond_broadcast (&page_released, &pc_lock);
+}
+
+/* Writes PAGE back if it is dirty.  The caller must have pinned
+   PAGE, but not locked it, and must not hold pc_lock. */
+static void
+page_clean (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+	bool dirty;
+
+	lock_acquire (&pc->lock);
+	lock_acquire (&pc_lock);
+	dirty = pc->dirty;
+	if (dirty) {
+		pc->dirty = false;
+		dirty_cnt--;
+	}
+	lock_release (&pc_lock);
+
+	if (dirty)
+		page_io (page, true);
+	lock_release (&pc->lock);
+}
+
+/* Reads PAGE's data from disk, or writes it there if WRITE is
+   true, directly between its frame and the disk, a run of
+   consecutive sectors per request.  Only the sectors that lie
+   within the file are transferred.  On reading, sectors that were
+   never written and the rest of the page past end of file are
+   zeroed. */
+static void
+page_io (struct page *page, bool write) {
+	struct page_cache *pc = &page->page_cache;
+	uint8_t *kva = page->frame->kva;
+	disk_sector_t sectors[PAGE_SECTORS];
+	off_t inode_left = inode_length (pc->inode) - pc->offset;
+	off_t bytes = inode_left < 0 ? 0 : inode_left < PGSIZE ? inode_left : PGSIZE;
+	size_t cnt = DIV_ROUND_UP (bytes, DISK_SECTOR_SIZE);
+	size_t i, run;
+
+	for (i = 0; i < cnt; i++) {
+		sectors[i] = inode_data_sector (pc->inode,
+				pc->offset + i * DISK_SECTOR_SIZE, write);
+
+		/* Every sector within the file is allocated, so a write
+		   always has one. */
+		ASSERT (!write || sectors[i] != 0);
+	}
+
+	for (i = 0; i < cnt; i += run) {
+		uint8_t *buffer = kva + i * DISK_SECTOR_SIZE;
+
+		for (run = 1; i + run < cnt && sectors[i] != 0
+				&& sectors[i + run] == sectors[i] + run; run++)
+			continue;
+		if (sectors[i] == 0)
+			memset (buffer, 0, DISK_SECTOR_SIZE);
+		else if (write)
+			disk_write_multiple (filesys_disk, sectors[i], run, buffer);
+		else
+			disk_read_multiple (filesys_disk, sectors[i], run, buffer);
+	}
+	if (!write)
+		memset (kva + bytes, 0, PGSIZE - bytes);
+}
+
+/* Writes back the dirty pages of INODE, or of every inode if
+   INODE is null, waiting for pages in use.  If DROP is true, also
+   takes all of INODE's pages out of the cache and frees them.
+   The pages are pinned first, so that none goes away meanwhile,
+   and then written without pc_lock. */
+static void
+flush_pages (struct inode *inode, bool drop) {
+	struct page *batch[PAGE_CACHE_SIZE];
+	struct list_elem *e;
+	size_t cnt = 0, i;
+
+	lock_acquire (&pc_lock);
+	for (e = list_begin (&lru); e != list_end (&lru); e = list_next (e)) {
+		struct page_cache *pc = list_entry (e, struct page_cache, lru_elem);
+
+		if ((inode != NULL && pc->inode != inode) || pc->evicting
+				|| (!drop && !pc->dirty))
+			continue;
+		ASSERT (cnt < PAGE_CACHE_SIZE);
+		pc->pin_cnt++;
+		batch[cnt++] = pc_to_page (pc);
+	}
+	lock_release (&pc_lock);
+
+	for (i = 0; i < cnt; i++) {
+		page_clean (batch[i]);
+		if (drop)
+			page_drop (batch[i]);
+		else {
+			lock_acquire (&pc_lock);
+			page_unpin (&batch[i]->page_cache);
+			lock_release (&pc_lock);
+		}
+	}
+
+	if (drop) {
+		/* Wait for INODE's pages that were on their way out. */
+		lock_acquire (&pc_lock);
+		for (e = list_begin (&lru); e != list_end (&lru); ) {
+			struct page_cache *pc = list_entry (e, struct page_cache, lru_elem);
+
+			if (pc->inode == inode) {
+				cond_wait (&page_released, &pc_lock);
+				e = list_begin (&lru);
+			} else
+				e = list_next (e);
+		}
+		lock_release (&pc_lock);
+	}
+}
+
+/* Returns a hash value for the page cache data at E. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = hash_entry (e, struct page_cache, elem);
+	return hash_bytes (&pc->inode, sizeof pc->inode)
+		^ hash_int (pc->offset / PGSIZE);
+}
+
+/* Orders page cache data by inode, then offset. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->offset < b->offset;
 }
+#endif /* VM && EFILESYS */
@@ -2,6 +2,9 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -15,6 +18,25 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors in one disk_request. */
+#define DISK_REQUEST_MAX 128
+
+struct disk_request;
+typedef void disk_request_func (struct disk_request *, void *aux);
+
+/* An asynchronous disk request.  See disk_submit(). */
+struct disk_request {
+	struct disk *disk;          /* Disk to access. */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                 /* True to write BUFFER to DISK. */
+	disk_request_func *done;    /* Called on completion, may be null. */
+	void *aux;                  /* Passed to DONE. */
+
+	struct list_elem elem;      /* Owned by disk.c. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +44,10 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+void disk_submit (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
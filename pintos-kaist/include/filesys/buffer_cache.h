@@ -0,0 +1,20 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Number of sectors held in the buffer cache. */
+#ifndef BUFFER_CACHE_SIZE
+#define BUFFER_CACHE_SIZE 64
+#endif
+
+void buffer_cache_init (void);
+void buffer_cache_read (disk_sector_t, void *, size_t ofs, size_t size);
+void buffer_cache_write (disk_sector_t, const void *, size_t ofs, size_t size);
+void buffer_cache_prefetch (disk_sector_t);
+void buffer_cache_discard (disk_sector_t);
+void buffer_cache_flush (void);
+void buffer_cache_done (void);
+
+#endif /* filesys/buffer_cache.h */
@@ -23,6 +23,8 @@ void fat_open (void);
 void fat_close (void);
 void fat_create (void);
 void fat_close (void);
+void fat_sync (void);
+void fat_print_stats (void);
 
 cluster_t fat_create_chain (
     cluster_t clst /* Cluster # to stretch, 0: Create a new chain */
@@ -31,8 +33,27 @@ void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
 );
+cluster_t fat_extend_chain (cluster_t clst, size_t cnt);
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
+cluster_t sector_to_cluster (disk_sector_t sector);
+
+/* Position within a cluster chain, kept by the chain's user (e.g.
+ * one per open inode) so that finding the cluster at a given
+ * index does not walk the chain from its head every time.  It
+ * remembers the run of physically consecutive clusters it was
+ * last in; since fat_extend_chain() allocates in runs, a seek
+ * usually lands in that run or takes only a few hops. */
+struct fat_cursor {
+	cluster_t start;      /* First cluster of the chain. */
+	size_t run_idx;       /* Chain index of RUN_CLST. */
+	cluster_t run_clst;   /* First cluster of the cached run, 0 if none. */
+	size_t run_len;       /* Clusters in the cached run. */
+};
+
+void fat_cursor_init (struct fat_cursor *, cluster_t start);
+cluster_t fat_cursor_seek (struct fat_cursor *, size_t idx);
+cluster_t fat_cursor_extend (struct fat_cursor *, size_t idx);
 
 #endif /* filesys/fat.h */
@@ -16,8 +16,12 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_prefetch (struct inode *, off_t size, off_t offset);
+disk_sector_t inode_data_sector (struct inode *, off_t pos, bool write);
+bool inode_grow (struct inode *, off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+bool inode_write_denied (const struct inode *);
 off_t inode_length (const struct inode *);
 
 #endif /* filesys/inode.h */
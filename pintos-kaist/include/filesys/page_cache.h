@@ -1,12 +1,40 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
 
 struct page;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* A page of file data held in the page cache. */
+struct page_cache {
+	struct inode *inode;        /* File the data belongs to. */
+	off_t offset;               /* Page-aligned offset of the data in INODE. */
+	int pin_cnt;                /* Threads using or waiting for this page. */
+	bool loaded;                /* Has the data been read in? */
+	bool dirty;                 /* Modified since read in? */
+	bool evicting;              /* On its way out of the cache? */
+	bool accessed;              /* Used since the frame table looked? */
+	struct lock lock;           /* Protects LOADED and the data. */
+	struct hash_elem elem;      /* Element in the page cache table. */
+	struct list_elem lru_elem;  /* Element in the LRU list. */
+};
+
+#include "vm/vm.h"
 
-void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+void page_cache_prefetch (struct inode *, off_t size, off_t offset);
+struct page *page_cache_get (struct inode *, off_t offset);
+void page_cache_put (struct page *, bool dirty);
+void page_cache_sync (struct inode *);
+void page_cache_release (struct inode *);
+void page_cache_flush (void);
+bool page_cache_test_accessed (struct page *);
 #endif
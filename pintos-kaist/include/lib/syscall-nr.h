@@ -36,6 +36,9 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Appended so that existing numbers stay put. */
+	SYS_SPAWN,                  /* Start a process running a program. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -92,16 +92,23 @@ struct thread {							//thread 구조체
 	char name[16];                      /* Name (for debugging purposes). */
 	int priority;                       /* Priority. */
 	int64_t getuptick;					// 일어날 시간
+	uint64_t sleep_seq;					// 같은 틱에 잠든 스레드 사이의 순서
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
 
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
+	struct file *exec_file;             // 실행 중인 파일, 쓰기 금지 상태로 열어 둔다
+	struct file **fd_table;             // 파일 디스크립터 테이블 (한 페이지)
+	int exit_status;                    // exit()로 넘긴 종료 코드, 커널이 죽이면 -1
+	struct list children;               // 자식들의 종료 정보 (struct process_status)
+	struct process_status *exit_info;   // 부모와 함께 쓰는 자신의 종료 정보
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	uintptr_t user_rsp;                 // 커널 진입 시점의 유저 rsp (스택 확장 판단용)
 #endif
 
 	/* Owned by thread.c. */
@@ -114,12 +121,12 @@ struct thread {							//thread 구조체
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
-int64_t global_tick;
 
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_ticks (int64_t cnt);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -134,7 +141,9 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
-void timer_sleep (int64_t ticks);
+void thread_sleep (int64_t getuptick);
+void thread_wakeup (int64_t now);
+int64_t thread_next_wakeup (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
@@ -1,11 +1,43 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "filesys/off_t.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* File descriptors.  0 and 1 are the console; the rest index a
+ * page of open files. */
+#define FD_MIN 2
+#define FD_MAX ((int) (PGSIZE / sizeof (struct file *)))
+
+/* Exit status of a process, shared by the process and its parent
+ * so that it outlives whichever of the two exits first. */
+struct process_status {
+	tid_t tid;                  /* The process's thread. */
+	int exit_status;            /* Valid once EXITED is up. */
+	struct semaphore exited;    /* Upped when the process exits. */
+	int ref_cnt;                /* 2 while both are alive. */
+	struct list_elem elem;      /* Element in the parent's CHILDREN. */
+};
+
+#ifdef VM
+struct page;
+
+/* Where lazy_load_segment() finds the contents of a page of the
+ * executable. */
+struct segment_aux {
+	off_t ofs;                  /* Offset of the page's data. */
+	size_t read_bytes;          /* Bytes to read; the rest is zeroed. */
+};
+
+bool lazy_load_segment (struct page *page, void *aux);
+#endif
 
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
 int process_exec (void *f_name);
+tid_t process_spawn (const char *file, char *const argv[]);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
@@ -1,6 +1,15 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct intr_frame;
+
+/* Serializes calls into the file system. */
+extern struct lock filesys_lock;
+
 void syscall_init (void);
+bool syscall_fixup (struct intr_frame *);
 
 #endif /* userprog/syscall.h */
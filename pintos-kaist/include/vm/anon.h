@@ -5,9 +5,12 @@ struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;           /* Swap slot holding the data, or SIZE_MAX. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_share_slot (struct page *page, struct page *other);
+void vm_anon_print_stats (void);
 
 #endif
@@ -1,7 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -33,6 +35,16 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct inode;
+
+/* Read-only file data that processes running the same program
+ * share a frame for: READ_BYTES bytes at OFS in INODE, then zeros.
+ * INODE is null for data that are not shared this way. */
+struct text_key {
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;
+};
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -46,6 +58,11 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in the owner's SPT. */
+	struct thread *owner;  /* Thread whose SPT and page table hold it. */
+	struct list_elem frame_elem;  /* Element in the frame's PAGES. */
+	struct text_key text;  /* Shared read-only data it will hold. */
+	bool writable;         /* May the user write to the page? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +76,20 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * After fork(), a frame may be shared, read-only, by the pages of
+ * several processes until one of them writes to it. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;     /* One of PAGES. */
+	struct list pages;     /* Pages whose data the frame holds. */
+	size_t page_cnt;       /* Number of PAGES. */
+	struct text_key text;  /* Shared read-only data it holds. */
+	struct hash_elem text_elem; /* Element in the text frame table. */
+	bool pinned;           /* Kept out of the clock hands' way? */
+	bool active;           /* On the active list? */
+	bool referenced;       /* Found accessed once on the inactive list? */
+	struct list_elem elem; /* Element in the frame table. */
 };
 
 /* The function table for page operations.
@@ -85,8 +112,14 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;     /* Pages by page-aligned user address. */
+	struct thread *owner;  /* Thread whose address space it describes. */
 };
 
+/* Function called by spt_for_each() and spt_for_range() for each
+ * page.  Returning false stops the iteration. */
+typedef bool spt_action_func (struct page *page, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,8 +129,13 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_for_each (struct supplemental_page_table *spt,
+		spt_action_func *action, void *aux);
+bool spt_for_range (struct supplemental_page_table *spt, void *start,
+		void *end, spt_action_func *action, void *aux);
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -106,7 +144,14 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
+void vm_share_text (void *upage, struct inode *inode, off_t ofs,
+		size_t read_bytes);
 bool vm_claim_page (void *va);
+bool vm_readaround_page (struct page *page, const void *data);
+#ifdef EFILESYS
+bool vm_claim_cache_page (struct page *page);
+void vm_free_cache_page (struct page *page);
+#endif
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
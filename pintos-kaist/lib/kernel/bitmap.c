@@ -62,6 +62,56 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a mask of the CNT bits starting at bit OFS of an
+   element.  OFS + CNT must not exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt) {
+	elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+	return mask << ofs;
+}
+
+/* Returns element IDX of B with the bits equal to VALUE set to 1
+   and the others set to 0. */
+static inline elem_type
+elem_match (const struct bitmap *b, size_t idx, bool value) {
+	return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of 1 bits in X.  We avoid
+   __builtin_popcountl(), which without -mpopcnt becomes a call
+   into libgcc, and the kernel does not link against libgcc. */
+static inline size_t
+elem_popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the first bit in B at or after START,
+   and before END, that is set to VALUE.  Returns END if there is
+   none.  Whole elements without such a bit are skipped at once. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) {
+	size_t idx, last_idx;
+	elem_type w;
+
+	if (start >= end)
+		return end;
+
+	idx = elem_idx (start);
+	last_idx = elem_idx (end - 1);
+	w = elem_match (b, idx, value) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (w == 0) {
+		if (++idx > last_idx)
+			return end;
+		w = elem_match (b, idx, value);
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (w);
+	return start < end ? start : end;
+}
 
 /* Creation and destruction. */
 
@@ -194,33 +244,51 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Works an element at a time; each element is updated
+   atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+		elem_type mask = range_mask (ofs, n);
+		elem_type *e = &b->bits[elem_idx (start)];
+
+		if (value)
+			asm ("lock orq %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+		start += n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	while (start < end) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+
+		value_cnt += elem_popcount (elem_match (b, elem_idx (start), value)
+				& range_mask (ofs, n));
+		start += n;
+	}
 	return value_cnt;
 }
 
@@ -228,16 +296,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -263,6 +326,32 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B that are all set to VALUE and lie
+   entirely between START and END.  Runs are found by jumping
+   from one VALUE bit to the next !VALUE bit, so each element is
+   looked at about once.
+   If there is no such group, returns BITMAP_ERROR. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t end, size_t cnt,
+		bool value) {
+	if (cnt == 0)
+		return start;
+
+	while (start + cnt <= end) {
+		size_t run_end;
+
+		start = find_next (b, start, end, value);
+		if (start + cnt > end)
+			break;
+		run_end = find_next (b, start, start + cnt, !value);
+		if (run_end == start + cnt)
+			return start;
+		start = run_end;
+	}
+	return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -272,16 +361,37 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
-	}
+	if (cnt <= b->bit_cnt)
+		return scan_range (b, start, b->bit_cnt, cnt, value);
 	return BITMAP_ERROR;
 }
 
+/* Like bitmap_scan(), but next-fit: searches from HINT to the end
+   of B first, then wraps around and searches from the beginning
+   up to HINT.  Callers typically pass the index just past their
+   previous allocation, so that they don't rescan the densely
+   used front of the bitmap every time.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_from_hint (const struct bitmap *b, size_t hint, size_t cnt,
+		bool value) {
+	size_t idx;
+
+	ASSERT (b != NULL);
+
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (hint > b->bit_cnt)
+		hint = 0;
+
+	idx = scan_range (b, hint, b->bit_cnt, cnt, value);
+	if (idx == BITMAP_ERROR && hint > 0) {
+		size_t end = hint + cnt - 1 < b->bit_cnt ? hint + cnt - 1 : b->bit_cnt;
+		idx = scan_range (b, 0, end, cnt, value);
+	}
+	return idx;
+}
+
 /* Finds the first group of CNT consecutive bits in B at or after
    START that are all set to VALUE, flips them all to !VALUE,
    and returns the index of the first bit in the group.
@@ -0,0 +1,6 @@
+/* Grows a file from 0 bytes to 20,000 bytes, 1,234 bytes at a
+   time.  fat-sync.ck then checks that the kernel wrote back only
+   the FAT sectors that the growth changed, not the whole FAT. */
+
+#define TEST_SIZE 20000
+#include "tests/filesys/extended/grow-seq.inc"
@@ -0,0 +1,31 @@
+# -*- perl -*-
+
+# The file's 40 or so clusters are allocated together, so they are
+# named in a few FAT sectors, and only those should be written back,
+# at shutdown or by the FAT flusher, out of the dozens in the FAT.
+
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($stats) = grep (/^FAT: \d+ sectors, \d+ written back$/, @output);
+fail "FAT statistics missing\n" if !defined $stats;
+my ($sectors, $written) = $stats =~ /^FAT: (\d+) sectors, (\d+) written/;
+fail "wrote back $written of $sectors FAT sectors\n"
+  if $written == 0 || $written >= $sectors / 2;
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fat-sync) begin
+(fat-sync) create "testme"
+(fat-sync) open "testme"
+(fat-sync) writing "testme"
+(fat-sync) close "testme"
+(fat-sync) open "testme" for verification
+(fat-sync) verified contents of "testme"
+(fat-sync) close "testme"
+(fat-sync) end
+EOF
+pass;
@@ -0,0 +1,102 @@
+/* Benchmark for bitmap_scan() in lib/kernel/bitmap.c.
+
+   Fills a 1M-bit map with a random pattern of short free runs,
+   then times repeated scans for groups of free bits with the
+   original bit-at-a-time algorithm and with bitmap_scan(), and
+   checks that both return the same answers.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of bits in the map. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of scans timed for each algorithm. */
+#define SCAN_CNT 20
+
+static size_t old_scan (const struct bitmap *, size_t start, size_t cnt,
+                        bool value);
+static int64_t time_scans (size_t (*) (const struct bitmap *, size_t, size_t,
+                                       bool),
+                           const struct bitmap *, size_t results[]);
+
+/* Run the bitmap scan benchmark. */
+void
+test (void) 
+{
+  static size_t old_results[SCAN_CNT], new_results[SCAN_CNT];
+  struct bitmap *b;
+  int64_t old_ticks, new_ticks;
+  size_t i;
+
+  b = bitmap_create (BIT_CNT);
+  ASSERT (b != NULL);
+
+  /* Mostly used bits, with free runs of 1 to 8 bits scattered
+     through the map.  Scans for 16 free bits then have to walk
+     the whole map. */
+  bitmap_set_all (b, true);
+  for (i = 0; i < BIT_CNT; i += 64 + random_ulong () % 64)
+    {
+      size_t run = 1 + random_ulong () % 8;
+      if (i + run <= BIT_CNT)
+        bitmap_set_multiple (b, i, run, false);
+    }
+
+  printf ("bitmap: scanning %d bits %d times:", BIT_CNT, SCAN_CNT);
+  old_ticks = time_scans (old_scan, b, old_results);
+  new_ticks = time_scans (bitmap_scan, b, new_results);
+  for (i = 0; i < SCAN_CNT; i++)
+    ASSERT (old_results[i] == new_results[i]);
+  printf (" old %lld ticks, new %lld ticks\n",
+          (long long) old_ticks, (long long) new_ticks);
+
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
+
+/* Runs SCAN_CNT scans of B with SCAN, for group sizes 1 to
+   SCAN_CNT, storing the results into RESULTS[].  Returns the
+   number of timer ticks taken. */
+static int64_t
+time_scans (size_t (*scan) (const struct bitmap *, size_t, size_t, bool),
+            const struct bitmap *b, size_t results[]) 
+{
+  int64_t start = timer_ticks ();
+  size_t i;
+
+  for (i = 0; i < SCAN_CNT; i++)
+    results[i] = scan (b, 0, i + 1, false);
+  return timer_elapsed (start);
+}
+
+/* The original bitmap_scan(): tests every candidate starting
+   position one bit at a time. */
+static size_t
+old_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i, j;
+
+      for (i = start; i <= last; i++)
+        {
+          for (j = 0; j < cnt; j++)
+            if (bitmap_test (b, i + j) != value)
+              break;
+          if (j == cnt)
+            return i;
+        }
+    }
+  return BITMAP_ERROR;
+}
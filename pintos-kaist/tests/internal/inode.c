@@ -0,0 +1,98 @@
+/* Benchmark for the open-inode table in filesys/inode.c.
+
+   Creates FILE_CNT empty inodes, then repeatedly opens all of
+   them (so that the table holds FILE_CNT entries at its peak)
+   and closes them again, and reports the number of
+   inode_open() calls per second.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <stdio.h>
+#include "filesys/filesys.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#else
+#include "filesys/free-map.h"
+#endif
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of distinct inodes. */
+#define FILE_CNT 4096
+
+/* Number of times every inode is opened. */
+#define ROUND_CNT 16
+
+/* Run the inode benchmark. */
+void
+test (void) 
+{
+  disk_sector_t *sectors;
+  struct inode **inodes;
+  int64_t start, elapsed;
+  long long ops;
+  int round, i;
+
+  sectors = malloc (sizeof *sectors * FILE_CNT);
+  inodes = malloc (sizeof *inodes * FILE_CNT);
+  ASSERT (sectors != NULL && inodes != NULL);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+#ifdef EFILESYS
+      cluster_t clst = fat_create_chain (0);
+      ASSERT (clst != 0);
+      sectors[i] = cluster_to_sector (clst);
+#else
+      ASSERT (free_map_allocate (1, &sectors[i]));
+#endif
+      ASSERT (inode_create (sectors[i], 0));
+    }
+
+  printf ("inode: %d inodes, %d rounds:", FILE_CNT, ROUND_CNT);
+
+  start = timer_ticks ();
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      for (i = 0; i < FILE_CNT; i++)
+        {
+          inodes[i] = inode_open (sectors[i]);
+          ASSERT (inodes[i] != NULL);
+          ASSERT (inode_get_inumber (inodes[i]) == sectors[i]);
+        }
+
+      /* A second open must find the same inode. */
+      for (i = 0; i < FILE_CNT; i++)
+        {
+          struct inode *inode = inode_open (sectors[i]);
+          ASSERT (inode == inodes[i]);
+          inode_close (inode);
+        }
+
+      for (i = 0; i < FILE_CNT; i++)
+        inode_close (inodes[i]);
+    }
+  elapsed = timer_elapsed (start);
+  if (elapsed == 0)
+    elapsed = 1;
+
+  ops = (long long) ROUND_CNT * FILE_CNT * 2;
+  printf (" %lld opens in %lld ticks, %lld opens/s\n",
+          ops, (long long) elapsed, ops * TIMER_FREQ / elapsed);
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      struct inode *inode = inode_open (sectors[i]);
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  free (inodes);
+  free (sectors);
+  printf ("inode: PASS\n");
+}
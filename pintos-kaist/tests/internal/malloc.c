@@ -0,0 +1,89 @@
+/* Benchmark for threads/malloc.c.
+
+   Starts many kernel threads that each repeatedly allocate and
+   free a mix of small blocks, then reports the aggregate number
+   of malloc()/free() pairs per second.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of concurrent worker threads. */
+#define THREAD_CNT 32
+
+/* Number of malloc()/free() pairs done by each worker. */
+#define OPS_PER_THREAD 20000
+
+/* Number of blocks each worker keeps live at a time. */
+#define LIVE_CNT 16
+
+static void worker (void *);
+
+/* Run the malloc benchmark. */
+void
+test (void) 
+{
+  struct semaphore done;
+  int64_t start, elapsed;
+  long long ops;
+  int i;
+
+  printf ("malloc: %d threads, %d ops each:", THREAD_CNT, OPS_PER_THREAD);
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "malloc %d", i);
+      thread_create (name, PRI_DEFAULT, worker, &done);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&done);
+  elapsed = timer_elapsed (start);
+  if (elapsed == 0)
+    elapsed = 1;
+
+  ops = (long long) THREAD_CNT * OPS_PER_THREAD;
+  printf (" %lld ops in %lld ticks, %lld ops/s\n",
+          ops, (long long) elapsed, ops * TIMER_FREQ / elapsed);
+  printf ("malloc: PASS\n");
+}
+
+/* Worker thread.  Keeps LIVE_CNT blocks of random small sizes
+   live, replacing a random one on each iteration. */
+static void
+worker (void *done_) 
+{
+  struct semaphore *done = done_;
+  void *live[LIVE_CNT];
+  int i;
+
+  for (i = 0; i < LIVE_CNT; i++)
+    live[i] = NULL;
+
+  for (i = 0; i < OPS_PER_THREAD; i++)
+    {
+      size_t slot = random_ulong () % LIVE_CNT;
+      size_t size = 16 << (random_ulong () % 7);
+
+      free (live[slot]);
+      live[slot] = malloc (size);
+      ASSERT (live[slot] != NULL);
+      *(char *) live[slot] = (char) i;
+    }
+
+  for (i = 0; i < LIVE_CNT; i++)
+    free (live[i]);
+  sema_up (done);
+}
@@ -0,0 +1,75 @@
+/* 10,000개의 스레드를 만들어 각각 서로 다른 시간 동안 휴면시킨다.
+   모든 스레드가 깨어나는지, 그리고 요청한 시간보다 일찍 깨어난
+   스레드가 없는지 확인한다. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 10000        /* 생성할 스레드 수 */
+#define MAX_SLEEP 97            /* 최대 휴면 틱 수 */
+
+/* Information about the test. */
+struct stress_test 
+  {
+    struct semaphore done;      /* 스레드가 깨어날 때마다 up 된다. */
+    struct lock lock;           /* early_cnt를 보호한다. */
+    int early_cnt;              /* 일찍 깨어난 스레드 수 */
+  };
+
+static void sleeper (void *);
+
+void
+test_alarm_stress (void) 
+{
+  struct stress_test test;
+  int i;
+
+  /* 이 테스트는 MLFQS.와 함께 작동하지 않는다. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep up to %d ticks each.",
+       THREAD_CNT, MAX_SLEEP);
+
+  sema_init (&test.done, 0);
+  lock_init (&test.lock);
+  test.early_cnt = 0;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, &test) == TID_ERROR)
+        fail ("thread_create failed for thread %d", i);
+    }
+
+  /* 모든 스레드가 깨어날 때까지 기다린다. */
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&test.done);
+
+  msg ("All %d threads woke up.", THREAD_CNT);
+  if (test.early_cnt != 0)
+    fail ("%d threads woke up early", test.early_cnt);
+  pass ();
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *test_) 
+{
+  struct stress_test *test = test_;
+  int64_t ticks = thread_tid () * 7 % MAX_SLEEP + 1;
+  int64_t start = timer_ticks ();
+
+  timer_sleep (ticks);
+  if (timer_elapsed (start) < ticks)
+    {
+      lock_acquire (&test->lock);
+      test->early_cnt++;
+      lock_release (&test->lock);
+    }
+  sema_up (&test->done);
+}
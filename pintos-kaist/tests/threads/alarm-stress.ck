@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-stress) begin
+(alarm-stress) Creating 10000 threads to sleep up to 97 ticks each.
+(alarm-stress) All 10000 threads woke up.
+(alarm-stress) PASS
+(alarm-stress) end
+EOF
+pass;
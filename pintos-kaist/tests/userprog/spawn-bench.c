@@ -0,0 +1,70 @@
+/* Starts child-simple over and over, first with fork() and exec(),
+   then with spawn(), and reports what each way costs per child,
+   in time stamp counter cycles. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RUNS 20
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static pid_t
+start_fork_exec (void)
+{
+  pid_t pid = fork ("child-simple");
+
+  if (pid == 0)
+    {
+      exec ("child-simple");
+      fail ("exec \"child-simple\"");
+    }
+  return pid;
+}
+
+static pid_t
+start_spawn (void)
+{
+  char *argv[] = {"child-simple", NULL};
+
+  return spawn ("child-simple", argv);
+}
+
+/* Starts and waits for RUNS children with START, and returns the
+   average cycles each took. */
+static uint64_t
+time_children (pid_t (*start) (void))
+{
+  uint64_t begin = rdtsc ();
+  int i;
+
+  for (i = 0; i < RUNS; i++)
+    {
+      pid_t pid = start ();
+
+      if (pid == PID_ERROR)
+        fail ("could not start child-simple");
+      if (wait (pid) != 81)
+        fail ("wrong exit status from child-simple");
+    }
+  return (rdtsc () - begin) / RUNS;
+}
+
+void
+test_main (void)
+{
+  uint64_t fork_exec_cycles = time_children (start_fork_exec);
+  uint64_t spawn_cycles = time_children (start_spawn);
+
+  msg ("fork+exec: %llu cycles per child", fork_exec_cycles);
+  msg ("spawn: %llu cycles per child", spawn_cycles);
+}
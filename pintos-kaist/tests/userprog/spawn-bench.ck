@@ -0,0 +1,21 @@
+# -*- perl -*-
+
+# The numbers vary from run to run, so only check that both ways
+# of starting a child worked and were timed.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "fork+exec was not timed\n"
+  if !grep (/^\(spawn-bench\) fork\+exec: \d+ cycles per child$/, @output);
+fail "spawn was not timed\n"
+  if !grep (/^\(spawn-bench\) spawn: \d+ cycles per child$/, @output);
+fail "test did not end\n" if !grep (/^\(spawn-bench\) end$/, @output);
+pass;
@@ -0,0 +1,59 @@
+/* Forks a process with a large, resident data area over and over.
+   Each child writes to a few pages of it and reports how many of
+   its pages ended up copied: with copy-on-write, only the ones it
+   wrote to. */
+
+#include <syscall.h>
+#include <stdint.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define BUF_PAGES 256
+#define WRITE_PAGES 4
+#define FORK_CNT 16
+
+static char buf[BUF_PAGES * PAGE_SIZE];
+static void *parent_pa[BUF_PAGES];
+
+/* Returns the number of pages of BUF that are no longer in the
+   parent's frames. */
+static int
+count_copied (void)
+{
+	int cnt = 0;
+	int i;
+
+	for (i = 0; i < BUF_PAGES; i++)
+		if (get_phys_addr (buf + i * PAGE_SIZE) != parent_pa[i])
+			cnt++;
+	return cnt;
+}
+
+void
+test_main (void)
+{
+	int total = 0;
+	int i, j;
+
+	for (i = 0; i < BUF_PAGES; i++) {
+		buf[i * PAGE_SIZE] = i;
+		parent_pa[i] = get_phys_addr (buf + i * PAGE_SIZE);
+	}
+
+	for (i = 0; i < FORK_CNT; i++) {
+		pid_t child = fork ("child");
+
+		if (child == 0) {
+			for (j = 0; j < WRITE_PAGES; j++)
+				buf[(i * WRITE_PAGES + j) % BUF_PAGES * PAGE_SIZE]++;
+			exit (count_copied ());
+		}
+		if (child < 0)
+			fail ("fork failed");
+		total += wait (child);
+	}
+
+	msg ("forked %d children", FORK_CNT);
+	msg ("pages copied per fork: %d of %d", total / FORK_CNT, BUF_PAGES);
+}
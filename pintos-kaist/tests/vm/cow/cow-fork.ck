@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-fork) begin
+(cow-fork) forked 16 children
+(cow-fork) pages copied per fork: 4 of 256
+(cow-fork) end
+EOF
+pass;
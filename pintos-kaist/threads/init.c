@@ -105,6 +105,10 @@ main (void) {
 	thread_start ();					//project 1과 관련된 부분이 시작되는 것으로 보임 
 	serial_init_queue ();				//스케줄러 생성?
 	timer_calibrate ();
+#ifdef USERPROG
+	/* CPU가 쉬는 동안 사용자 페이지를 미리 0으로 채워 둔다. */
+	palloc_start_zeroer ();
+#endif
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -221,6 +225,8 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
@@ -326,6 +332,7 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -tickless          Stop the periodic timer tick while idle.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -354,12 +361,19 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+#endif
+#ifdef EFILESYS
+	fat_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -28,18 +29,45 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
+   In front of each descriptor's free list sits a small
+   "magazine": a stack of free blocks that malloc() and free()
+   can pop and push with interrupts briefly disabled, without
+   taking the descriptor's lock.  Pintos runs on one CPU, so the
+   magazine is effectively a per-CPU cache.  An empty magazine is
+   refilled with MAG_BATCH blocks under a single lock
+   acquisition, and a full one is drained by the same amount.
+   Blocks held in a magazine count as in use by their arena.
+
+   New arenas are not split into blocks up front.  Instead, the
+   descriptor remembers the newest arena and carves blocks off it
+   only when the free list runs dry.
+
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
    the beginning of the allocated block's arena header. */
 
+/* Magazine capacity, and number of blocks moved between a
+   magazine and its descriptor's free list at a time. */
+#define MAG_SIZE 32
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Magazine of free blocks.  Accessed with interrupts off. */
+struct magazine {
+	size_t cnt;                         /* Number of blocks held. */
+	struct block *blocks[MAG_SIZE];     /* Free blocks, a stack. */
+};
+
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
+	struct arena *carve_arena;  /* Newest arena, partly carved. */
+	size_t carve_next;          /* Next block to carve from it. */
 	struct lock lock;           /* Lock. */
+	struct magazine mag;        /* Blocks cached in front of lock. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -63,6 +91,8 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t desc_get_blocks (struct desc *, struct block **, size_t cnt);
+static void desc_put_blocks (struct desc *, struct block **, size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -75,7 +105,10 @@ malloc_init (void) {
 		d->block_size = block_size;
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
+		d->carve_arena = NULL;
+		d->carve_next = 0;
 		lock_init (&d->lock);
+		d->mag.cnt = 0;
 	}
 }
 
@@ -84,8 +117,10 @@ malloc_init (void) {
 void *
 malloc (size_t size) {
 	struct desc *d;
-	struct block *b;
+	struct block *batch[MAG_BATCH];
 	struct arena *a;
+	enum intr_level old_level;
+	size_t cnt;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
@@ -112,35 +147,107 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
+	/* Fast path: take a block from the magazine. */
+	old_level = intr_disable ();
+	if (d->mag.cnt > 0) {
+		struct block *b = d->mag.blocks[--d->mag.cnt];
+		intr_set_level (old_level);
+		return b;
+	}
+	intr_set_level (old_level);
 
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
+	/* Slow path: fetch a batch from the descriptor, return one
+	   block and keep the rest in the magazine. */
+	cnt = desc_get_blocks (d, batch, MAG_BATCH);
+	if (cnt == 0)
+		return NULL;
 
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
+	old_level = intr_disable ();
+	while (cnt > 1 && d->mag.cnt < MAG_SIZE)
+		d->mag.blocks[d->mag.cnt++] = batch[--cnt];
+	intr_set_level (old_level);
 
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
+	/* Another thread may have filled the magazine meanwhile. */
+	if (cnt > 1)
+		desc_put_blocks (d, batch + 1, cnt - 1);
+	return batch[0];
+}
+
+/* Takes up to CNT free blocks from descriptor D, storing them
+   into BLOCKS, and returns the number of blocks taken.  Fewer
+   than CNT are returned only if memory runs out. */
+static size_t
+desc_get_blocks (struct desc *d, struct block **blocks, size_t cnt) {
+	size_t n = 0;
+
+	lock_acquire (&d->lock);
+	while (n < cnt) {
+		struct block *b;
+		struct arena *a;
+
+		if (!list_empty (&d->free_list))
+			b = list_entry (list_pop_front (&d->free_list), struct block,
+					free_elem);
+		else {
+			/* If the newest arena is fully carved, create a new one. */
+			if (d->carve_arena == NULL
+					|| d->carve_next >= d->blocks_per_arena) {
+				a = palloc_get_page (0);
+				if (a == NULL)
+					break;
+
+				a->magic = ARENA_MAGIC;
+				a->desc = d;
+				a->free_cnt = d->blocks_per_arena;
+				d->carve_arena = a;
+				d->carve_next = 0;
+			}
+			b = arena_to_block (d->carve_arena, d->carve_next++);
 		}
+
+		a = block_to_arena (b);
+		a->free_cnt--;
+		blocks[n++] = b;
 	}
+	lock_release (&d->lock);
+
+	return n;
+}
+
+/* Returns the CNT blocks in BLOCKS to descriptor D's free list,
+   giving arenas that become entirely unused back to the page
+   allocator. */
+static void
+desc_put_blocks (struct desc *d, struct block **blocks, size_t cnt) {
+	size_t i;
+
+	lock_acquire (&d->lock);
+	for (i = 0; i < cnt; i++) {
+		struct block *b = blocks[i];
+		struct arena *a = block_to_arena (b);
+
+		/* Add block to free list. */
+		list_push_front (&d->free_list, &b->free_elem);
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
+		/* If the arena is now entirely unused, free it.  Only
+		   the blocks carved so far are on the free list. */
+		if (++a->free_cnt >= d->blocks_per_arena) {
+			size_t carved = d->blocks_per_arena;
+			size_t j;
+
+			ASSERT (a->free_cnt == d->blocks_per_arena);
+			if (a == d->carve_arena) {
+				carved = d->carve_next;
+				d->carve_arena = NULL;
+			}
+			for (j = 0; j < carved; j++) {
+				struct block *b = arena_to_block (a, j);
+				list_remove (&b->free_elem);
+			}
+			palloc_free_page (a);
+		}
+	}
 	lock_release (&d->lock);
-	return b;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -207,30 +314,29 @@ free (void *p) {
 
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
+			struct block *batch[MAG_BATCH + 1];
+			enum intr_level old_level;
+			size_t cnt = 0;
 
 #ifndef NDEBUG
 			/* Clear the block to help detect use-after-free bugs. */
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+			/* Fast path: push the block onto the magazine.  If it
+			   is full, drain a batch back to the descriptor. */
+			old_level = intr_disable ();
+			if (d->mag.cnt < MAG_SIZE) {
+				d->mag.blocks[d->mag.cnt++] = b;
+				intr_set_level (old_level);
+				return;
 			}
+			while (cnt < MAG_BATCH)
+				batch[cnt++] = d->mag.blocks[--d->mag.cnt];
+			intr_set_level (old_level);
 
-			lock_release (&d->lock);
+			batch[cnt++] = b;
+			desc_put_blocks (d, batch, cnt);
 		} else {
 			/* It's a big block.  Free its pages. */
 			palloc_free_multiple (a, a->free_cnt);
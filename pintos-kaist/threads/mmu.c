@@ -223,8 +223,8 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 /* Adds a mapping in page map level 4 PML4 from user virtual page
  * UPAGE to the physical frame identified by kernel virtual address KPAGE.
- * UPAGE must not already be mapped. KPAGE should probably be a page obtained
- * from the user pool with palloc_get_page().
+ * If UPAGE is already mapped, the mapping is replaced. KPAGE should probably
+ * be a page obtained from the user pool with palloc_get_page().
  * If WRITABLE is true, the new page is read/write;
  * otherwise it is read-only.
  * Returns true if successful, false if memory allocation
@@ -238,8 +238,11 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
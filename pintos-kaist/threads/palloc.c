@@ -2,14 +2,17 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,13 +27,47 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
-
-/* A memory pool. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed by a binary buddy allocator.  Free memory
+   is kept as blocks of 2**ORDER pages, aligned to their size
+   relative to the pool base, on one free list per order.  The
+   free lists are threaded through the free pages themselves.  A
+   request for PAGE_CNT pages takes the smallest block that fits,
+   splitting larger blocks as needed, and gives the unused tail
+   back.  Freeing a block merges it with its buddy for as long as
+   the buddy is also free.  Both run in O(log n).
+
+   used_map still records which pages are in use, so that
+   double frees can be caught. */
+
+/* Number of buddy orders: blocks of 1 page up to 2**19 pages
+   (2 GB) per block. */
+#define MAX_ORDER 20
+
+/* Value of order_map[] for a page that is not the first page of
+   a free block. */
+#define NOT_FREE_HEAD 0xff
+
+/* A memory pool.  Its members are changed only with interrupts
+   off, so that pages can be freed where sleeping is not allowed,
+   such as in do_schedule(). */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	uint8_t *order_map;             /* Per page: order of the free block
+	                                   starting there, or NOT_FREE_HEAD. */
+	struct list free_lists[MAX_ORDER]; /* Free blocks, one list per order. */
+
+	/* Statistics. */
+	size_t free_cnt[MAX_ORDER];     /* Length of each free list. */
+	size_t split_cnt;               /* Blocks split on allocation. */
+	size_t merge_cnt;               /* Buddies merged on free. */
+};
+
+/* Header of a free block, stored in the block's first page. */
+struct free_block {
+	struct list_elem elem;          /* Element in pool's free_lists[]. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -38,10 +75,33 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Pages of the user pool zeroed ahead of time.
+
+   The zeroer thread runs at the lowest priority, so only when
+   nothing else wants the CPU, and keeps up to ZEROED_MAX free
+   user pages zeroed here.  A PAL_ZERO request for a single user
+   page takes one of them instead of zeroing on the spot.  The
+   pages count as allocated, but once the user pool is otherwise
+   empty any single-page request takes them too, so they never
+   cost anyone a page.  All of this is changed only with interrupts
+   off. */
+#define ZEROED_MAX 32
+static void *zeroed_pages[ZEROED_MAX];
+static size_t zeroed_cnt;
+static bool zeroer_starved;             /* Zeroer waits for a free page? */
+static struct semaphore zeroer_wakeup;
+static size_t zeroed_hit_cnt;           /* PAL_ZERO requests served. */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void init_free_lists (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void print_pool_stats (const char *name, struct pool *);
+static void *zeroed_take (void);
+static thread_func zeroer;
 
 /* multiboot info */
 struct multiboot_info {
@@ -250,9 +310,19 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	init_free_lists (&kernel_pool);
+	init_free_lists (&user_pool);
+	sema_init (&zeroer_wakeup, 0);
 	return ext_mem.end;
 }
 
+/* Starts the thread that zeroes free user pages in idle time. */
+void
+palloc_start_zeroer (void) {
+	if (thread_create ("zeroer", PRI_MIN, zeroer, NULL) == TID_ERROR)
+		PANIC ("can't start zeroer thread");
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -262,19 +332,36 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
-
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	bool single_user = pool == &user_pool && page_cnt == 1;
+	void *pages = NULL;
+	bool zeroed = false;
+	enum intr_level old_level;
+
+	if (page_cnt == 0)
+		return NULL;
+
+	old_level = intr_disable ();
+	if (single_user && (flags & PAL_ZERO)) {
+		pages = zeroed_take ();
+		zeroed = pages != NULL;
+		if (zeroed)
+			zeroed_hit_cnt++;
+	}
+	if (pages == NULL) {
+		size_t page_idx = buddy_alloc (pool, page_cnt);
+		if (page_idx != BITMAP_ERROR) {
+			ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			pages = pool->base + PGSIZE * page_idx;
+		} else if (single_user) {
+			pages = zeroed_take ();
+			zeroed = pages != NULL;
+		}
+	}
+	intr_set_level (old_level);
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -301,6 +388,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -318,8 +406,15 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	old_level = intr_disable ();
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_free_range (pool, page_idx, page_cnt);
+	if (pool == &user_pool && zeroer_starved) {
+		zeroer_starved = false;
+		sema_up (&zeroer_wakeup);
+	}
+	intr_set_level (old_level);
 }
 
 /* PAGE 주소에 있는 단일 페이지를 해제한다. */
@@ -328,6 +423,50 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Takes a page out of the pool of zeroed pages and returns it, or
+   returns a null pointer if the pool is empty.  Interrupts must be
+   off. */
+static void *
+zeroed_take (void) {
+	if (zeroed_cnt == 0)
+		return NULL;
+	sema_up (&zeroer_wakeup);
+	return zeroed_pages[--zeroed_cnt];
+}
+
+/* Zeroer thread.  Refills the pool of zeroed pages from the free
+   pages of the user pool, and sleeps while the pool is full or
+   the user pool has nothing free. */
+static void
+zeroer (void *aux UNUSED) {
+	for (;;) {
+		size_t page_idx = BITMAP_ERROR;
+		enum intr_level old_level;
+		void *page;
+
+		old_level = intr_disable ();
+		if (zeroed_cnt < ZEROED_MAX) {
+			page_idx = buddy_alloc (&user_pool, 1);
+			if (page_idx != BITMAP_ERROR)
+				bitmap_mark (user_pool.used_map, page_idx);
+			else
+				zeroer_starved = true;
+		}
+		intr_set_level (old_level);
+
+		if (page_idx == BITMAP_ERROR) {
+			sema_down (&zeroer_wakeup);
+			continue;
+		}
+
+		page = user_pool.base + PGSIZE * page_idx;
+		memset (page, 0, PGSIZE);
+		old_level = intr_disable ();
+		zeroed_pages[zeroed_cnt++] = page;
+		intr_set_level (old_level);
+	}
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,8 +475,8 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
 
-	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
 
@@ -345,6 +484,179 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	bitmap_set_all(p->used_map, true);
 
 	*bm_base += bm_pages;
+
+	/* The buddy order map follows the bitmap.  The free lists are
+	   filled in by init_free_lists() once the usable ranges are
+	   known. */
+	p->order_map = *bm_base;
+	memset (p->order_map, NOT_FREE_HEAD, pgcnt);
+	*bm_base += om_pages;
+}
+
+/* Builds pool P's buddy free lists from the pages that
+   populate_pools() marked free in its used_map. */
+static void
+init_free_lists (struct pool *p) {
+	size_t pgcnt = bitmap_size (p->used_map);
+	size_t idx = 0;
+	int order;
+
+	for (order = 0; order < MAX_ORDER; order++) {
+		list_init (&p->free_lists[order]);
+		p->free_cnt[order] = 0;
+	}
+	p->split_cnt = p->merge_cnt = 0;
+
+	while (idx < pgcnt) {
+		size_t run;
+
+		if (bitmap_test (p->used_map, idx)) {
+			idx++;
+			continue;
+		}
+		for (run = 1; idx + run < pgcnt; run++)
+			if (bitmap_test (p->used_map, idx + run))
+				break;
+		buddy_free_range (p, idx, run);
+		idx += run;
+	}
+
+	/* Building the lists is not real merging. */
+	p->merge_cnt = 0;
+}
+
+/* Returns the free block header for page PAGE_IDX of pool P. */
+static struct free_block *
+idx_to_block (struct pool *p, size_t page_idx) {
+	return (struct free_block *) (p->base + PGSIZE * page_idx);
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX on P's free list. */
+static void
+push_block (struct pool *p, size_t page_idx, int order) {
+	list_push_front (&p->free_lists[order],
+			&idx_to_block (p, page_idx)->elem);
+	p->order_map[page_idx] = order;
+	p->free_cnt[order]++;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off P's
+   free list. */
+static void
+remove_block (struct pool *p, size_t page_idx, int order) {
+	ASSERT (p->order_map[page_idx] == order);
+	list_remove (&idx_to_block (p, page_idx)->elem);
+	p->order_map[page_idx] = NOT_FREE_HEAD;
+	p->free_cnt[order]--;
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+cnt_to_order (size_t page_cnt) {
+	int order = 0;
+
+	while (((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Allocates PAGE_CNT contiguous pages from pool P and returns the
+   index of the first one, or BITMAP_ERROR if no block is large
+   enough.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *p, size_t page_cnt) {
+	int want = cnt_to_order (page_cnt);
+	int order;
+	size_t page_idx;
+
+	for (order = want; order < MAX_ORDER; order++)
+		if (!list_empty (&p->free_lists[order]))
+			break;
+	if (order >= MAX_ORDER)
+		return BITMAP_ERROR;
+
+	page_idx = pg_no (list_front (&p->free_lists[order])) - pg_no (p->base);
+	remove_block (p, page_idx, order);
+
+	/* Split down to the wanted order, freeing the upper halves. */
+	while (order > want) {
+		order--;
+		push_block (p, page_idx + ((size_t) 1 << order), order);
+		p->split_cnt++;
+	}
+
+	/* Give back the pages past PAGE_CNT. */
+	if (page_cnt < ((size_t) 1 << want))
+		buddy_free_range (p, page_idx + page_cnt,
+				((size_t) 1 << want) - page_cnt);
+	return page_idx;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in pool P,
+   merging it with its buddy as long as the buddy is free. */
+static void
+buddy_free_block (struct pool *p, size_t page_idx, int order) {
+	size_t pgcnt = bitmap_size (p->used_map);
+
+	while (order < MAX_ORDER - 1) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+		if (buddy + ((size_t) 1 << order) > pgcnt
+				|| p->order_map[buddy] != order)
+			break;
+		remove_block (p, buddy, order);
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+		p->merge_cnt++;
+	}
+	push_block (p, page_idx, order);
+}
+
+/* Frees PAGE_CNT pages starting at PAGE_IDX in pool P, splitting
+   the range into the largest aligned blocks it contains.
+   Interrupts must be off, except during initialization. */
+static void
+buddy_free_range (struct pool *p, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = 0;
+
+		while (order < MAX_ORDER - 1
+				&& (page_idx & ((size_t) 1 << order)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_free_block (p, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool_stats ("kernel", &kernel_pool);
+	print_pool_stats ("user", &user_pool);
+	printf ("Palloc: user pool: %zu zeroed pages ready, %zu handed out\n",
+			zeroed_cnt, zeroed_hit_cnt);
+}
+
+/* Prints statistics for pool P, called NAME. */
+static void
+print_pool_stats (const char *name, struct pool *p) {
+	size_t free_pages = 0;
+	int order, top = 0;
+
+	for (order = 0; order < MAX_ORDER; order++) {
+		free_pages += p->free_cnt[order] << order;
+		if (p->free_cnt[order] != 0)
+			top = order;
+	}
+	printf ("Palloc: %s pool: %zu free pages, %zu splits, %zu merges\n",
+			name, free_pages, p->split_cnt, p->merge_cnt);
+	printf ("Palloc: %s pool: free blocks by order:", name);
+	for (order = 0; order <= top; order++)
+		printf (" %zu", p->free_cnt[order]);
+	printf ("\n");
 }
 
 /* Returns true if PAGE was allocated from POOL,
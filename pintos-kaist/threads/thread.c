@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -10,6 +11,7 @@
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -25,10 +27,25 @@
 #define THREAD_BASIC 0xd42df210	//10진수는 3559780880, unsigned 정수 범위에 해당
 
 /* THREAD_READY 상태에 있는 프로세스들의 목록
-   실행할 준비는 되었지만 실제로 실행 중은 아닌 프로세스들 */
-static struct list ready_list;
+   실행할 준비는 되었지만 실제로 실행 중은 아닌 프로세스들.
+   우선순위(PRI_MIN..PRI_MAX)마다 FIFO 큐를 하나씩 두고,
+   ready_bitmap의 비트 N은 ready_queues[N]이 비어 있지 않음을 뜻한다.
+   삽입은 O(1), 가장 높은 우선순위는 비트 스캔 한 번으로 찾는다. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+
+#if PRI_MAX - PRI_MIN >= 64
+#error ready_bitmap holds at most 64 priority levels
+#endif
 
-static struct list sleep_list;		//추가++
+/* timer_sleep()으로 잠든 스레드들의 이진 최소 힙(min-heap).
+   (getuptick, sleep_seq) 순으로 정렬되어 sleep_heap[0]이 가장 먼저 깨어날 스레드이다.
+   삽입과 삭제는 O(log n)이고, 매 틱마다 하는 일은 깨어날 스레드 수에 비례한다.
+   배열은 thread_sleep()에서 인터럽트가 켜진 상태로 두 배씩 늘린다. */
+static struct thread **sleep_heap;
+static size_t sleep_heap_cnt;		/* 힙에 들어 있는 스레드 수 */
+static size_t sleep_heap_cap;		/* sleep_heap 배열의 용량 */
+static uint64_t sleep_seq;			/* 같은 틱에 깨어나는 스레드들의 FIFO 순서 */
 
 
 /* Idle thread. */
@@ -65,9 +82,13 @@ static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static void ready_enqueue (struct thread *);
+static struct thread *ready_dequeue (void);
+static int ready_max_priority (void);
+static void sleep_heap_grow (void);
+static void sleep_heap_push (struct thread *);
+static struct thread *sleep_heap_pop (void);
 
-void thread_sleep (int64_t getuptick); //++ 추가
-bool sleep(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED); //++추가
 bool sort_list(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED); //++추가
 /* 메크로, t가 유효한 스레드를 가리키면 true를 반환한다. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC) //t의 magic 멤버가 THREAD_MAGIC 과 같다면
@@ -105,10 +126,12 @@ thread_init (void) {
 
 	/* 전역 스레드 컨텍스트를 초기화한다. */
 	lock_init (&tid_lock);			
-	list_init (&ready_list);
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init (&ready_queues[pri]);
+	ready_bitmap = 0;
 	list_init (&destruction_req);
-	list_init (&sleep_list);
-	global_tick = INT64_MAX;			//추가++
+	sleep_heap = NULL;
+	sleep_heap_cnt = sleep_heap_cap = 0;
 
 
 	/* 현재 실행 중인 스레드를 위한 스레드 구조체를 설정한다 */
@@ -157,6 +180,14 @@ thread_tick (void) {
 		intr_yield_on_return ();	//intr_yield_return을 true로?
 }
 
+/* tickless 모드에서 타이머 인터럽트 없이 idle 상태로 지나간
+   CNT 틱을 통계에 더한다. 인터럽트가 꺼진 상태에서 호출된다. */
+void
+thread_idle_ticks (int64_t cnt) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	idle_ticks += cnt;
+}
+
 /* 스레드 통계 정보를 출력 */
 void
 thread_print_stats (void) {	//각각의 ticks를 print?
@@ -245,7 +276,7 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();		//인터럽트를 비활성화하고, 이전 인터럽트 상태를 반환
 	ASSERT (t->status == THREAD_BLOCKED);//t가 THREAD_BLOCKED 상태라면? ASSERT는 디버그용?
-	list_insert_ordered(&ready_list, &t->elem, sort_list, NULL);
+	ready_enqueue (t);
 
 	t->status = THREAD_READY;			//t를 THREAD_READY 상태로 변경한다.
 	intr_set_level (old_level);			//이전 인터럽드 상태로 set한다?
@@ -298,6 +329,8 @@ thread_exit (void) {
 	NOT_REACHED ();				//도달하지 않음??
 }
 
+/* 현재 스레드를 GETUPTICKS 틱이 될 때까지 재운다.
+   timer_interrupt()가 thread_wakeup()으로 깨워줄 때까지 다시 스케줄되지 않는다. */
 void
 thread_sleep (int64_t getupticks) 
 {
@@ -310,53 +343,134 @@ thread_sleep (int64_t getupticks)
 	old_level = intr_disable (); //인터럽트 비활성화
 	if (curr != idle_thread)		//현재 쓰레드가 idle_thread가 아니라면
 	{
+		/* 힙에 자리가 없으면 인터럽트를 켠 상태에서 배열을 늘린다. */
+		while (sleep_heap_cnt >= sleep_heap_cap)
+		{
+			intr_set_level (old_level);
+			sleep_heap_grow ();
+			old_level = intr_disable ();
+		}
 		curr->getuptick = getupticks;								//깨어날 시간을 getupick으로 저장
-		list_insert_ordered(&sleep_list, &curr->elem, sleep, NULL);	//리스트에 정렬 삽입
-		struct thread *target = list_entry(list_begin(&sleep_list), struct thread, elem); 
-		global_tick = target->getuptick;							//가장 작은 값을 global_tick으로
+		sleep_heap_push (curr);										//힙에 삽입, O(log n)
 		thread_block();										
 	}
 	intr_set_level (old_level); //인터럽트 수준을 원래 상태로 설정한다.
 }
 
-void wakeup()
+/* 깨어날 시간이 NOW 이하인 스레드를 모두 깨운다.
+   매 틱마다 timer_interrupt()에서 호출되며, 깨울 스레드가 없으면
+   힙의 맨 위만 확인하고 바로 반환한다. */
+void
+thread_wakeup (int64_t now)
 {
-	if(list_empty(&sleep_list))
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (sleep_heap_cnt > 0 && sleep_heap[0]->getuptick <= now)
+		thread_unblock (sleep_heap_pop ());
+}
+
+/* 가장 먼저 깨어날 스레드의 깨어날 시간을 반환한다.
+   잠든 스레드가 없으면 INT64_MAX를 반환한다. */
+int64_t
+thread_next_wakeup (void)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	return sleep_heap_cnt > 0 ? sleep_heap[0]->getuptick : INT64_MAX;
+}
+
+/* sleep_heap의 용량을 두 배로 늘린다.
+   palloc이 lock을 사용하므로 인터럽트가 켜진 상태에서 호출해야 한다. */
+static void
+sleep_heap_grow (void)
+{
+	size_t old_cap = sleep_heap_cap;
+	size_t new_cap = old_cap > 0 ? old_cap * 2 : PGSIZE / sizeof *sleep_heap;
+	size_t new_pages = DIV_ROUND_UP (new_cap * sizeof *sleep_heap, PGSIZE);
+	struct thread **new_heap, **old_heap;
+	enum intr_level old_level;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	new_heap = palloc_get_multiple (0, new_pages);
+	if (new_heap == NULL)
+		PANIC ("thread_sleep: out of memory for %zu sleepers", new_cap);
+
+	old_level = intr_disable ();
+	if (sleep_heap_cap != old_cap)
 	{
+		/* 그 사이 다른 스레드가 먼저 늘렸다. */
+		intr_set_level (old_level);
+		palloc_free_multiple (new_heap, new_pages);
 		return;
 	}
+	if (sleep_heap_cnt > 0)
+		memcpy (new_heap, sleep_heap, sleep_heap_cnt * sizeof *sleep_heap);
+	old_heap = sleep_heap;
+	sleep_heap = new_heap;
+	sleep_heap_cap = new_cap;
+	intr_set_level (old_level);
+
+	if (old_heap != NULL)
+		palloc_free_multiple (old_heap,
+				DIV_ROUND_UP (old_cap * sizeof *sleep_heap, PGSIZE));
+}
 
-	enum intr_level old_level;
-	old_level = intr_disable (); //인터럽트 비활성화	
-	
-	struct list_elem *start = list_begin(&sleep_list);				//sleep_list의 가장 앞의 값을 start로 
+/* A가 B보다 먼저 깨어나야 하면 true.
+   깨어날 틱이 같으면 먼저 잠든 스레드가 먼저 깨어난다. */
+static bool
+sleep_before (const struct thread *a, const struct thread *b)
+{
+	if (a->getuptick != b->getuptick)
+		return a->getuptick < b->getuptick;
+	return a->sleep_seq < b->sleep_seq;
+}
 
-	while(start != list_end(&sleep_list))							//start가 list의 끝이 아니면
+/* T를 sleep_heap에 넣는다. 빈 자리가 있어야 하며 인터럽트가 꺼져 있어야 한다. */
+static void
+sleep_heap_push (struct thread *t)
+{
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (sleep_heap_cnt < sleep_heap_cap);
+
+	t->sleep_seq = sleep_seq++;
+	for (i = sleep_heap_cnt++; i > 0; )
 	{
-		struct thread *start_thread = list_entry(start, struct thread, elem);//start로 start_thread를 반환
-		if(start_thread->getuptick <= global_tick)							 //global_tick보다 작은 값을 찾는다.
-		{
-			struct list_elem *next = start->next;							//start의 다음을 next로 저장
-			list_pop_front (&sleep_list);									//최소 값을 삭제
-			thread_unblock(start_thread);									//현재 start_thread를 unblock
-			start = next;													//start에 다음 값을 저장
-		}
-		else
-		{
+		size_t parent = (i - 1) / 2;
+		if (!sleep_before (t, sleep_heap[parent]))
 			break;
-		}
-	}	
-	//global_tick 갱신
-	if(!list_empty(&sleep_list))
-	{
-		global_tick = list_entry(start, struct thread, elem)->getuptick;
-	}	
-	else
-	{
-		global_tick = INT64_MAX;
+		sleep_heap[i] = sleep_heap[parent];
+		i = parent;
 	}
+	sleep_heap[i] = t;
+}
 
-	intr_set_level (old_level); //인터럽트 수준을 원래 상태로 설정한다.
+/* 가장 먼저 깨어날 스레드를 sleep_heap에서 꺼내 반환한다. */
+static struct thread *
+sleep_heap_pop (void)
+{
+	struct thread *top, *last;
+	size_t i, child;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (sleep_heap_cnt > 0);
+
+	top = sleep_heap[0];
+	last = sleep_heap[--sleep_heap_cnt];
+	for (i = 0; (child = 2 * i + 1) < sleep_heap_cnt; i = child)
+	{
+		if (child + 1 < sleep_heap_cnt
+				&& sleep_before (sleep_heap[child + 1], sleep_heap[child]))
+			child++;
+		if (!sleep_before (sleep_heap[child], last))
+			break;
+		sleep_heap[i] = sleep_heap[child];
+	}
+	if (sleep_heap_cnt > 0)
+		sleep_heap[i] = last;
+	return top;
 }
 
 /* CPU를 양보한다.
@@ -373,7 +487,7 @@ thread_yield (void) {
 	old_level = intr_disable (); //인터럽트 비활성화
 	if (curr != idle_thread)
 	{
-		list_insert_ordered(&ready_list, &curr->elem, sort_list, NULL);
+		ready_enqueue (curr);
 	}
 	do_schedule (THREAD_READY); //현재 실행 중인 스레드의 상태를 준비상태로
 	intr_set_level (old_level); //인터럽트 수준을 원래 상태로 설정한다.
@@ -384,14 +498,18 @@ void	//수정 ++
 thread_set_priority (int new_priority) {
 	
 	struct thread *curr_thread = thread_current ();
+	enum intr_level old_level;
+	int max_priority;
+
  	curr_thread->priority = new_priority;
-	if(!list_empty(&ready_list))
+
+	old_level = intr_disable ();
+	max_priority = ready_max_priority ();
+	intr_set_level (old_level);
+
+	if(curr_thread->priority < max_priority)
 	{
-		struct thread *first_thread = list_entry(list_begin(&ready_list), struct thread, elem);
-		if(curr_thread->priority < first_thread->priority)
-		{
-			thread_yield();
-		}
+		thread_yield();
 	}
 }
 
@@ -449,6 +567,11 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();					//인터럽트 비활성화
 		thread_block ();					//현재 스레드를 block한다.
 
+		/* 실행할 스레드가 없다. tickless 모드라면 다음에 깨어날
+		   스레드가 있을 때까지 주기적인 타이머 인터럽트를 멈춘다.
+		   idle이 다시 전환되어 나갈 때 schedule()이 되돌린다. */
+		timer_idle_enter ();
+
 		/* 인터럽트를 다시 활성화하고, 다음 인터럽트를 기다린다.
 
 		   sti 명령어는 다음 명령어가 완료될 때까지 인터럽트를 비활성화하기 때문에,
@@ -492,6 +615,10 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->priority = priority;	// 인자로 받은 priority를 t의 priority에 대입한다.
 	t->magic = THREAD_MAGIC;// t의 magic을 THREAD_MAGIC을 대입
 	t->getuptick = 0;
+#ifdef USERPROG
+	t->exit_status = -1;		// exit() 없이 끝나면 커널이 죽인 것
+	list_init (&t->children);
+#endif
 }
 
 /* 다음에 스케줄될 스레드를 선택하여 반환한다.
@@ -502,10 +629,56 @@ init_thread (struct thread *t, const char *name, int priority) {
    실행 대기 큐가 비어 있다면, idle_thread를 반환한다. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))	//list가 비었는지 확인
-		return idle_thread;			//비었으면 idle_thread 반환
-	else	//리스트 요소, 외부 구조체 이름, 리스트 요소의 멤버이름을 받아서 요소가 포함 되어있는 구조체의 포인터를 반환
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+	struct thread *next = ready_dequeue ();
+
+	if (next == NULL)				//실행 대기 큐가 모두 비었다면
+		return idle_thread;			//idle_thread 반환
+	else
+		return next;
+}
+
+/* T를 자신의 우선순위 큐 맨 뒤에 넣고 bitmap의 해당 비트를 켠다.
+   같은 우선순위끼리는 FIFO(round-robin) 순서가 유지된다.
+   인터럽트가 꺼진 상태에서 호출되어야 한다. */
+static void
+ready_enqueue (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	list_push_back (&ready_queues[t->priority], &t->elem);
+	ready_bitmap |= 1ULL << t->priority;
+}
+
+/* 가장 높은 우선순위 큐의 맨 앞 스레드를 꺼내 반환한다.
+   실행 대기 중인 스레드가 없으면 NULL을 반환한다.
+   인터럽트가 꺼진 상태에서 호출되어야 한다. */
+static struct thread *
+ready_dequeue (void) {
+	struct list *queue;
+	struct thread *t;
+	int pri;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	pri = ready_max_priority ();
+	if (pri < PRI_MIN)
+		return NULL;
+
+	queue = &ready_queues[pri];
+	t = list_entry (list_pop_front (queue), struct thread, elem);
+	if (list_empty (queue))
+		ready_bitmap &= ~(1ULL << pri);
+	return t;
+}
+
+/* 실행 대기 중인 스레드의 가장 높은 우선순위를 반환한다.
+   대기 중인 스레드가 없으면 PRI_MIN - 1을 반환한다.
+   PRI_MAX가 63이므로 64비트 bitmap 하나에 bsr 한 번이면 된다. */
+static int
+ready_max_priority (void) {
+	if (ready_bitmap == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll (ready_bitmap);
 }
 
 /* iretq 명령어를 사용하여 스레드를 실행한다. */
@@ -625,7 +798,13 @@ do_schedule(int status) { 					//상태를 받아서 schedule한다?
 static void
 schedule (void) {
 	struct thread *curr = running_thread ();	//현재 실행중인 thread
-	struct thread *next = next_thread_to_run ();//다음의 스케줄 대기중인 thread
+	struct thread *next;
+
+	/* idle 스레드가 tickless 상태에서 다른 인터럽트로 깨어났다면
+	   지나간 틱을 반영하고 주기적인 타이머로 되돌린다. */
+	if (curr == idle_thread)
+		timer_idle_exit ();
+	next = next_thread_to_run ();				//다음의 스케줄 대기중인 thread
 
 	ASSERT (intr_get_level () == INTR_OFF);		//OFF상태 인지
 	ASSERT (curr->status != THREAD_RUNNING);	//curr의 상태가 실행중이 아닌지
@@ -685,14 +864,6 @@ allocate_tid (void) {
 }
 
 
-bool sleep(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-	struct thread *a_thread = list_entry(a, struct thread, elem);
-	struct thread *b_thread = list_entry(b, struct thread, elem);
-	
-	return 	a_thread->getuptick < b_thread->getuptick;
-}
-
 bool sort_list(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
 {
 	struct thread *a_thread = list_entry(a, struct thread, elem);
@@ -2,8 +2,10 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
@@ -149,6 +151,20 @@ page_fault (struct intr_frame *f) {
 	/* Count page faults. */
 	page_fault_cnt++;
 
+	/* A bad access to user memory by get_user() or put_user() on
+	   behalf of a system call fails instead, so that the system
+	   call can let go of what it holds before the process dies. */
+	if (!user && is_user_vaddr (fault_addr) && syscall_fixup (f))
+		return;
+
+	/* A bad access by the user program, or by the kernel to a bad
+	   address that it was passed in a system call: the process
+	   dies, not the kernel. */
+	if (user || is_user_vaddr (fault_addr)) {
+		thread_current ()->exit_status = -1;
+		thread_exit ();
+	}
+
 	/* If the fault is true fault, show info and exit. */
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
 			fault_addr,
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -13,6 +14,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -22,15 +24,97 @@
 #include "vm/vm.h"
 #endif
 
+/* Most arguments a command line may have. */
+#define MAX_ARGS 64
+
 static void process_cleanup (void);
-static bool load (const char *file_name, struct intr_frame *if_);
-static void initd (void *f_name);
+static bool load (const char *file_name, int argc, char **argv,
+		struct intr_frame *if_);
+static void initd (void *aux);
 static void __do_fork (void *);
+static void spawnd (void *);
+
+/* Arguments to initd(). */
+struct initd_args {
+	char *cmd_line;                 /* Command line, in a page. */
+	struct process_status *status;  /* Shared with the parent. */
+};
+
+/* Arguments to __do_fork(), on the parent's stack. */
+struct fork_args {
+	struct thread *parent;
+	struct intr_frame *parent_if;   /* Parent's user context. */
+	struct process_status *status;  /* Shared with the parent. */
+	struct semaphore done;          /* Upped once the child is set up. */
+	bool success;                   /* Did the child set up fine? */
+};
+
+/* Arguments to spawnd(), in a page of their own. */
+struct spawn_args {
+	struct thread *parent;
+	struct process_status *status;  /* Shared with the parent. */
+	struct semaphore done;          /* Upped once the child is loaded. */
+	bool success;                   /* Did the child load fine? */
+	char *file_name;                /* Program to run. */
+	int argc;                       /* Number of arguments. */
+	char *argv[MAX_ARGS];           /* Its arguments. */
+	char strings[];                 /* What the pointers above point to. */
+};
 
-/* General process initializer for initd and other process. */
+/* Creates the exit status of a new child of the current process.
+ * Returns a null pointer if memory is short. */
+static struct process_status *
+status_create (void) {
+	struct process_status *status = malloc (sizeof *status);
+
+	if (status != NULL) {
+		status->tid = TID_ERROR;
+		status->exit_status = -1;
+		sema_init (&status->exited, 0);
+		status->ref_cnt = 2;
+	}
+	return status;
+}
+
+/* Drops a reference to STATUS, and frees it with the last one. */
 static void
-process_init (void) {
+status_release (struct process_status *status) {
+	enum intr_level old_level;
+	bool last;
+
+	old_level = intr_disable ();
+	last = --status->ref_cnt == 0;
+	intr_set_level (old_level);
+	if (last)
+		free (status);
+}
+
+/* General process initializer for initd and other process.
+ * STATUS is shared with the parent.  Returns false if memory is
+ * short. */
+static bool
+process_init (struct process_status *status) {
+	struct thread *current = thread_current ();
+
+	current->exit_info = status;
+	current->fd_table = palloc_get_page (PAL_ZERO);
+	return current->fd_table != NULL;
+}
+
+/* Gives the current process copies of the files PARENT has open.
+ * Returns false if memory is short. */
+static bool
+duplicate_files (struct thread *parent) {
 	struct thread *current = thread_current ();
+	int fd;
+
+	for (fd = FD_MIN; fd < FD_MAX; fd++)
+		if (parent->fd_table[fd] != NULL) {
+			current->fd_table[fd] = file_duplicate (parent->fd_table[fd]);
+			if (current->fd_table[fd] == NULL)
+				return false;
+		}
+	return true;
 }
 
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
@@ -40,33 +124,57 @@ process_init (void) {
  * Notice that THIS SHOULD BE CALLED ONCE. */
 tid_t
 process_create_initd (const char *file_name) {
-	char *fn_copy;
-	tid_t tid;
+	struct initd_args *args;
+	char name[sizeof thread_current ()->name];
+	char *prog_name, *save_ptr;
+	tid_t tid = TID_ERROR;
+
+	args = malloc (sizeof *args);
+	if (args == NULL)
+		return TID_ERROR;
+	args->status = status_create ();
 
 	/* Make a copy of FILE_NAME.
 	 * Otherwise there's a race between the caller and load(). */
-	fn_copy = palloc_get_page (0);
-	if (fn_copy == NULL)
-		return TID_ERROR;
-	strlcpy (fn_copy, file_name, PGSIZE);
+	args->cmd_line = palloc_get_page (0);
+	if (args->status == NULL || args->cmd_line == NULL)
+		goto done;
+	strlcpy (args->cmd_line, file_name, PGSIZE);
+
+	/* The thread is named after the program, without its arguments. */
+	strlcpy (name, file_name, sizeof name);
+	prog_name = strtok_r (name, " ", &save_ptr);
 
 	/* Create a new thread to execute FILE_NAME. */
-	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
-	if (tid == TID_ERROR)
-		palloc_free_page (fn_copy);
+	tid = thread_create (prog_name != NULL ? prog_name : name,
+			PRI_DEFAULT, initd, args);
+	if (tid != TID_ERROR) {
+		args->status->tid = tid;
+		list_push_back (&thread_current ()->children, &args->status->elem);
+		return tid;
+	}
+
+done:
+	if (args->cmd_line != NULL)
+		palloc_free_page (args->cmd_line);
+	free (args->status);
+	free (args);
 	return tid;
 }
 
 /* A thread function that launches first user process. */
 static void
-initd (void *f_name) {
+initd (void *aux) {
+	struct initd_args *args = aux;
+	char *cmd_line = args->cmd_line;
+	struct process_status *status = args->status;
+
+	free (args);
 #ifdef VM
 	supplemental_page_table_init (&thread_current ()->spt);
 #endif
 
-	process_init ();
-
-	if (process_exec (f_name) < 0)
+	if (!process_init (status) || process_exec (cmd_line) < 0)
 		PANIC("Fail to launch initd\n");
 	NOT_REACHED ();
 }
@@ -74,10 +182,34 @@ initd (void *f_name) {
 /* Clones the current process as `name`. Returns the new process's thread id, or
  * TID_ERROR if the thread cannot be created. */
 tid_t
-process_fork (const char *name, struct intr_frame *if_ UNUSED) {
+process_fork (const char *name, struct intr_frame *if_) {
+	struct fork_args args;
+	tid_t tid;
+
+	args.parent = thread_current ();
+	args.parent_if = if_;
+	args.status = status_create ();
+	if (args.status == NULL)
+		return TID_ERROR;
+	sema_init (&args.done, 0);
+	args.success = false;
+
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	tid = thread_create (name, PRI_DEFAULT, __do_fork, &args);
+	if (tid == TID_ERROR) {
+		free (args.status);
+		return TID_ERROR;
+	}
+
+	/* Do not return before the child has duplicated our resources. */
+	sema_down (&args.done);
+	args.status->tid = tid;
+	list_push_back (&thread_current ()->children, &args.status->elem);
+	if (!args.success) {
+		process_wait (tid);
+		return TID_ERROR;
+	}
+	return tid;
 }
 
 #ifndef VM
@@ -91,22 +223,28 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	void *newpage;
 	bool writable;
 
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
+	/* 1. If the parent_page is kernel page, then return immediately. */
+	if (is_kernel_vaddr (va))
+		return true;
 
 	/* 2. Resolve VA from the parent's page map level 4. */
 	parent_page = pml4_get_page (parent->pml4, va);
 
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
+	/* 3. Allocate new PAL_USER page for the child. */
+	newpage = palloc_get_page (PAL_USER);
+	if (newpage == NULL)
+		return false;
 
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
+	/* 4. Duplicate parent's page to the new page, with the same
+	 *    permission. */
+	memcpy (newpage, parent_page, PGSIZE);
+	writable = is_writable (pte);
 
 	/* 5. Add new page to child's page table at address VA with WRITABLE
 	 *    permission. */
 	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
+		palloc_free_page (newpage);
+		return false;
 	}
 	return true;
 }
@@ -119,14 +257,18 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 static void
 __do_fork (void *aux) {
 	struct intr_frame if_;
-	struct thread *parent = (struct thread *) aux;
+	struct fork_args *args = aux;
+	struct thread *parent = args->parent;
 	struct thread *current = thread_current ();
-	/* TODO: somehow pass the parent_if. (i.e. process_fork()'s if_) */
-	struct intr_frame *parent_if;
-	bool succ = true;
+	struct intr_frame *parent_if = args->parent_if;
 
-	/* 1. Read the cpu context to local stack. */
+	/* 1. Read the cpu context to local stack.  The child's fork()
+	 *    returns 0. */
 	memcpy (&if_, parent_if, sizeof (struct intr_frame));
+	if_.R.rax = 0;
+
+	if (!process_init (args->status))
+		goto error;
 
 	/* 2. Duplicate PT */
 	current->pml4 = pml4_create();
@@ -143,18 +285,121 @@ __do_fork (void *aux) {
 		goto error;
 #endif
 
-	/* TODO: Your code goes here.
-	 * TODO: Hint) To duplicate the file object, use `file_duplicate`
-	 * TODO:       in include/filesys/file.h. Note that parent should not return
-	 * TODO:       from the fork() until this function successfully duplicates
-	 * TODO:       the resources of parent.*/
+	/* 3. Duplicate the open files, and the executable, whose pages
+	 *    the child may still load. */
+	if (!duplicate_files (parent))
+		goto error;
+	if (parent->exec_file != NULL) {
+		current->exec_file = file_duplicate (parent->exec_file);
+		if (current->exec_file == NULL)
+			goto error;
+	}
+
+	/* Finally, let the parent return from fork(), and switch to the
+	 * newly created process. */
+	args->success = true;
+	sema_up (&args->done);
+	do_iret (&if_);
+error:
+	sema_up (&args->done);
+	thread_exit ();
+}
 
-	process_init ();
+/* Copies string S to *P, below END, and advances *P past the
+ * copy.  Returns the copy, or a null pointer if it does not fit. */
+static char *
+copy_arg (char **p, const char *end, const char *s) {
+	size_t len = strnlen (s, end - *p) + 1;
+	char *copy = *p;
+
+	if (len > (size_t) (end - *p))
+		return NULL;
+	memcpy (copy, s, len);
+	*p += len;
+	return copy;
+}
+
+/* Starts a new process running FILE with the null-terminated
+ * arguments ARGV, straight from the executable: unlike fork() and
+ * exec(), it never copies the current process's address space.
+ * The child gets copies of the current process's open files.
+ * Returns the new process's thread id, or TID_ERROR if it cannot
+ * be created or FILE cannot be loaded. */
+tid_t
+process_spawn (const char *file, char *const argv[]) {
+	struct spawn_args *args;
+	const char *end;
+	char *p;
+	tid_t tid;
+	int i;
+
+	args = palloc_get_page (0);
+	if (args == NULL)
+		return TID_ERROR;
+	args->parent = thread_current ();
+	args->status = status_create ();
+	if (args->status == NULL)
+		goto error;
+	sema_init (&args->done, 0);
+	args->success = false;
+
+	/* Copy the strings into the rest of the page.  Otherwise
+	 * there's a race between the caller and load(). */
+	p = args->strings;
+	end = (const char *) args + PGSIZE;
+	args->file_name = copy_arg (&p, end, file);
+	if (args->file_name == NULL)
+		goto error;
+	for (i = 0; argv[i] != NULL; i++)
+		if (i == MAX_ARGS
+				|| (args->argv[i] = copy_arg (&p, end, argv[i])) == NULL)
+			goto error;
+	args->argc = i;
+
+	tid = thread_create (args->file_name, PRI_DEFAULT, spawnd, args);
+	if (tid == TID_ERROR)
+		goto error;
+
+	/* Wait for the load, to report whether it worked. */
+	sema_down (&args->done);
+	args->status->tid = tid;
+	list_push_back (&thread_current ()->children, &args->status->elem);
+	if (!args->success) {
+		process_wait (tid);
+		tid = TID_ERROR;
+	}
+	palloc_free_page (args);
+	return tid;
 
-	/* Finally, switch to the newly created process. */
-	if (succ)
-		do_iret (&if_);
 error:
+	free (args->status);
+	palloc_free_page (args);
+	return TID_ERROR;
+}
+
+/* A thread function that loads the program of a process_spawn(). */
+static void
+spawnd (void *aux) {
+	struct spawn_args *args = aux;
+	struct intr_frame _if;
+	bool success;
+
+	_if.ds = _if.es = _if.ss = SEL_UDSEG;
+	_if.cs = SEL_UCSEG;
+	_if.eflags = FLAG_IF | FLAG_MBS;
+
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
+	success = (process_init (args->status)
+			&& duplicate_files (args->parent)
+			&& load (args->file_name, args->argc, args->argv, &_if));
+
+	/* ARGS belongs to the parent again from here. */
+	args->success = success;
+	sema_up (&args->done);
+	if (success)
+		do_iret (&_if);
 	thread_exit ();
 }
 
@@ -163,6 +408,9 @@ error:
 int
 process_exec (void *f_name) {
 	char *file_name = f_name;
+	char *argv[MAX_ARGS];
+	char *token, *save_ptr;
+	int argc = 0;
 	bool success;
 
 	/* We cannot use the intr_frame in the thread structure.
@@ -176,8 +424,13 @@ process_exec (void *f_name) {
 	/* We first kill the current context */
 	process_cleanup ();
 
-	/* And then load the binary */
-	success = load (file_name, &_if);
+	/* And then break the command line into words, and load the
+	 * binary named by the first. */
+	for (token = strtok_r (file_name, " ", &save_ptr);
+			token != NULL && argc < MAX_ARGS;
+			token = strtok_r (NULL, " ", &save_ptr))
+		argv[argc++] = token;
+	success = argc > 0 && load (argv[0], argc, argv, &_if);
 
 	/* If load failed, quit. */
 	palloc_free_page (file_name);
@@ -195,15 +448,27 @@ process_exec (void *f_name) {
  * exception), returns -1.  If TID is invalid or if it was not a
  * child of the calling process, or if process_wait() has already
  * been successfully called for the given TID, returns -1
- * immediately, without waiting.
- *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) {
-	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
-	 * XXX:       to add infinite loop here before
-	 * XXX:       implementing the process_wait. */
+process_wait (tid_t child_tid) {
+	struct thread *curr = thread_current ();
+	struct list_elem *e;
+
+	for (e = list_begin (&curr->children); e != list_end (&curr->children);
+			e = list_next (e)) {
+		struct process_status *child =
+			list_entry (e, struct process_status, elem);
+
+		if (child->tid == child_tid) {
+			int exit_status;
+
+			sema_down (&child->exited);
+			exit_status = child->exit_status;
+			list_remove (e);
+			status_release (child);
+			return exit_status;
+		}
+	}
 	return -1;
 }
 
@@ -211,12 +476,32 @@ process_wait (tid_t child_tid UNUSED) {
 void
 process_exit (void) {
 	struct thread *curr = thread_current ();
-	/* TODO: Your code goes here.
-	 * TODO: Implement process termination message (see
-	 * TODO: project2/process_termination.html).
-	 * TODO: We recommend you to implement process resource cleanup here. */
+	int fd;
+
+	if (curr->exit_info != NULL)
+		printf ("%s: exit(%d)\n", curr->name, curr->exit_status);
+
+	if (curr->fd_table != NULL) {
+		for (fd = FD_MIN; fd < FD_MAX; fd++)
+			file_close (curr->fd_table[fd]);
+		palloc_free_page (curr->fd_table);
+		curr->fd_table = NULL;
+	}
 
 	process_cleanup ();
+
+	/* Nobody is going to wait for the children any more. */
+	while (!list_empty (&curr->children))
+		status_release (list_entry (list_pop_front (&curr->children),
+					struct process_status, elem));
+
+	/* Tell the parent, once everything is freed. */
+	if (curr->exit_info != NULL) {
+		curr->exit_info->exit_status = curr->exit_status;
+		sema_up (&curr->exit_info->exited);
+		status_release (curr->exit_info);
+		curr->exit_info = NULL;
+	}
 }
 
 /* Free the current process's resources. */
@@ -244,6 +529,10 @@ process_cleanup (void) {
 		pml4_activate (NULL);
 		pml4_destroy (pml4);
 	}
+
+	/* Nothing is loaded from the executable any more. */
+	file_close (curr->exec_file);
+	curr->exec_file = NULL;
 }
 
 /* Sets up the CPU for running user code in the nest thread.
@@ -311,6 +600,7 @@ struct ELF64_PHDR {
 #define Phdr ELF64_PHDR
 
 static bool setup_stack (struct intr_frame *if_);
+static bool push_arguments (struct intr_frame *if_, int argc, char **argv);
 static bool validate_segment (const struct Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes,
@@ -318,10 +608,12 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 /* Loads an ELF executable from FILE_NAME into the current thread.
  * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
+ * and its initial stack pointer into *RSP, and passes it the ARGC
+ * arguments in ARGV.
  * Returns true if successful, false otherwise. */
 static bool
-load (const char *file_name, struct intr_frame *if_) {
+load (const char *file_name, int argc, char **argv,
+		struct intr_frame *if_) {
 	struct thread *t = thread_current ();
 	struct ELF ehdr;
 	struct file *file = NULL;
@@ -336,7 +628,9 @@ load (const char *file_name, struct intr_frame *if_) {
 	process_activate (thread_current ());
 
 	/* Open executable file. */
+	lock_acquire (&filesys_lock);
 	file = filesys_open (file_name);
+	lock_release (&filesys_lock);
 	if (file == NULL) {
 		printf ("load: %s: open failed\n", file_name);
 		goto done;
@@ -414,18 +708,66 @@ load (const char *file_name, struct intr_frame *if_) {
 	/* Start address. */
 	if_->rip = ehdr.e_entry;
 
-	/* TODO: Your code goes here.
-	 * TODO: Implement argument passing (see project2/argument_passing.html). */
+	if (!push_arguments (if_, argc, argv))
+		goto done;
 
+	/* The process goes by the name of its program from now on. */
+	strlcpy (t->name, file_name, sizeof t->name);
 	success = true;
 
 done:
-	/* We arrive here whether the load is successful or not. */
-	file_close (file);
+	/* We arrive here whether the load is successful or not.
+	 * A loaded executable stays open, with writes denied, while it
+	 * runs: its pages may still have to be read from it. */
+	if (success) {
+		file_deny_write (file);
+		t->exec_file = file;
+	} else
+		file_close (file);
 	return success;
 }
 
 
+/* Pushes the ARGC words in ARGV onto the user stack that IF_
+ * points to, laid out as main() expects them, and passes argc
+ * and argv in RDI and RSI.  Returns false if they do not fit in
+ * the stack page. */
+static bool
+push_arguments (struct intr_frame *if_, int argc, char **argv) {
+	uint8_t *rsp = (uint8_t *) if_->rsp;
+	uint8_t *limit = (uint8_t *) USER_STACK - PGSIZE;
+	size_t vec_size;
+	int i;
+
+	/* The strings themselves, last first.  ARGV is pointed at the
+	 * copies as they go. */
+	for (i = argc - 1; i >= 0; i--) {
+		size_t len = strlen (argv[i]) + 1;
+
+		if ((size_t) (rsp - limit) < len)
+			return false;
+		rsp -= len;
+		memcpy (rsp, argv[i], len);
+		argv[i] = (char *) rsp;
+	}
+
+	/* Word-align, then argv[argc] (a null pointer), argv[] itself
+	 * and a fake return address. */
+	rsp = (uint8_t *) ((uintptr_t) rsp & ~(uintptr_t) 7);
+	vec_size = (argc + 2) * sizeof (char *);
+	if ((size_t) (rsp - limit) < vec_size)
+		return false;
+	rsp -= vec_size;
+	((char **) rsp)[0] = NULL;
+	memcpy (rsp + sizeof (char *), argv, argc * sizeof (char *));
+	((char **) rsp)[argc + 1] = NULL;
+
+	if_->R.rdi = argc;
+	if_->R.rsi = (uint64_t) (rsp + sizeof (char *));
+	if_->rsp = (uint64_t) rsp;
+	return true;
+}
+
 /* Checks whether PHDR describes a valid, loadable segment in
  * FILE and returns true if so, false otherwise. */
 static bool
@@ -574,11 +916,19 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+/* Loads the contents of PAGE, a page of a segment described by
+ * AUX, on its first fault.  The data come from the executable of
+ * the process that owns PAGE, which stays open while it runs. */
+bool
+lazy_load_segment (struct page *page, void *aux_) {
+	struct segment_aux *aux = aux_;
+	uint8_t *kva = page->frame->kva;
+
+	if (file_read_at (page->owner->exec_file, kva, aux->read_bytes, aux->ofs)
+			!= (int) aux->read_bytes)
+		return false;
+	memset (kva + aux->read_bytes, 0, PGSIZE - aux->read_bytes);
+	return true;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -609,15 +959,27 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
+		struct segment_aux *aux = malloc (sizeof *aux);
+		if (aux == NULL)
+			return false;
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
 		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+					writable, lazy_load_segment, aux)) {
+			free (aux);
 			return false;
+		}
+
+		/* Read-only pages hold the same data in every process that
+		 * runs the program, and can share frames. */
+		if (!writable)
+			vm_share_text (upage, file_get_inode (file), ofs,
+					page_read_bytes);
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
 		upage += PGSIZE;
 	}
 	return true;
@@ -629,11 +991,11 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vm_alloc_page (VM_ANON, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
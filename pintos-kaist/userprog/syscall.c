@@ -1,16 +1,26 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "devices/input.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
+struct lock filesys_lock;
+
 /* System call.
  *
  * Previously system call services was handled by the interrupt handler
@@ -35,12 +45,432 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
+
+	lock_init (&filesys_lock);
+}
+
+/* Terminates the current process with STATUS. */
+static void NO_RETURN
+sys_exit (int status) {
+	thread_current ()->exit_status = status;
+	thread_exit ();
+}
+
+/* Where get_user() and put_user() resume after a fault. */
+extern const char get_user_done[], put_user_done[];
+
+/* Reads a byte at user virtual address UADDR, which must be below
+ * KERN_BASE.  Returns the byte value, or -1 if the access faulted.
+ * The address to resume at is left in RAX, where syscall_fixup()
+ * finds it.  Never inlined or cloned, so that its label is
+ * defined only once. */
+static int64_t __attribute__ ((noinline, noclone))
+get_user (const uint8_t *uaddr) {
+	int64_t result;
+	__asm __volatile (
+			"movabsq $get_user_done, %0\n"
+			"movzbq %1, %0\n"
+			"get_user_done:\n"
+			: "=&a" (result) : "m" (*uaddr));
+	return result;
+}
+
+/* Writes BYTE to user address UDST, which must be below
+ * KERN_BASE.  Returns true if successful, false if the access
+ * faulted, the same way as get_user(). */
+static bool __attribute__ ((noinline, noclone))
+put_user (uint8_t *udst, uint8_t byte) {
+	int64_t error_code;
+	__asm __volatile (
+			"movabsq $put_user_done, %0\n"
+			"movb %b2, %1\n"
+			"put_user_done:\n"
+			: "=&a" (error_code), "=m" (*udst) : "q" (byte));
+	return error_code != -1;
+}
+
+/* Recovers from page fault F, taken in the kernel, if it was taken
+ * by get_user() or put_user(): the access returns -1 instead.
+ * Returns false if F was taken anywhere else. */
+bool
+syscall_fixup (struct intr_frame *f) {
+	if ((f->R.rax != (uint64_t) get_user_done
+				&& f->R.rax != (uint64_t) put_user_done)
+			|| f->rip >= f->R.rax)
+		return false;
+	f->rip = f->R.rax;
+	f->R.rax = -1;
+	return true;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns false
+ * if USRC is not all readable user memory. */
+static bool
+copy_in (void *dst_, const void *usrc_, size_t size) {
+	uint8_t *dst = dst_;
+	const uint8_t *usrc = usrc_;
+
+	if (size > 0 && (usrc + size < usrc || !is_user_vaddr (usrc + size - 1)))
+		return false;
+	for (; size > 0; size--) {
+		int64_t byte = get_user (usrc++);
+		if (byte == -1)
+			return false;
+		*dst++ = byte;
+	}
+	return true;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns false
+ * if UDST is not all writable user memory. */
+static bool
+copy_out (void *udst_, const void *src_, size_t size) {
+	uint8_t *udst = udst_;
+	const uint8_t *src = src_;
+
+	if (size > 0 && (udst + size < udst || !is_user_vaddr (udst + size - 1)))
+		return false;
+	for (; size > 0; size--)
+		if (!put_user (udst++, *src++))
+			return false;
+	return true;
+}
+
+/* Checks that the SIZE bytes at user address UADDR may be read.
+ * A bad address kills the process.  Nothing is held here, so
+ * this is only for data that are copied without a lock. */
+static void
+check_user (const void *uaddr, size_t size) {
+	const uint8_t *start = uaddr;
+	const uint8_t *end = start + size;
+	const uint8_t *p;
+
+	if (size == 0)
+		return;
+	if (start == NULL || end < start || !is_user_vaddr (end - 1))
+		sys_exit (-1);
+	for (p = pg_round_down (start); p < end; p += PGSIZE)
+		if (get_user (p < start ? start : p) == -1)
+			sys_exit (-1);
+}
+
+/* Checks that the null-terminated string at user address US may
+ * be read, the same way as check_user(). */
+static void
+check_string (const char *us) {
+	if (us == NULL)
+		sys_exit (-1);
+	for (;; us++) {
+		int64_t c = is_user_vaddr (us) ? get_user ((const uint8_t *) us) : -1;
+
+		if (c == -1)
+			sys_exit (-1);
+		if (c == '\0')
+			return;
+	}
+}
+
+/* Returns a copy of the null-terminated string at user address US
+ * in a new page, truncated to fit, for use under filesys_lock,
+ * where user memory must not be touched: a fault there would kill
+ * the process with the lock held.  Kills the process if US is bad.
+ * Returns a null pointer if out of memory. */
+static char *
+copy_in_string (const char *us) {
+	char *page;
+	size_t i;
+
+	if (us == NULL)
+		sys_exit (-1);
+	page = palloc_get_page (0);
+	if (page == NULL)
+		return NULL;
+	for (i = 0; i < PGSIZE; i++) {
+		int64_t c = is_user_vaddr (us + i)
+			? get_user ((const uint8_t *) us + i) : -1;
+
+		if (c == -1) {
+			palloc_free_page (page);
+			sys_exit (-1);
+		}
+		page[i] = c;
+		if (c == '\0')
+			return page;
+	}
+	page[PGSIZE - 1] = '\0';
+	return page;
+}
+
+/* Returns the file open as FD in the current process, or a null
+ * pointer if there is none. */
+static struct file *
+fd_lookup (int fd) {
+	if (fd < FD_MIN || fd >= FD_MAX)
+		return NULL;
+	return thread_current ()->fd_table[fd];
+}
+
+static int
+sys_exec (const char *cmd_line) {
+	char *page;
+
+	check_string (cmd_line);
+	page = palloc_get_page (0);
+	if (page == NULL)
+		return -1;
+	strlcpy (page, cmd_line, PGSIZE);
+	if (process_exec (page) < 0)
+		sys_exit (-1);
+	NOT_REACHED ();
+}
+
+static tid_t
+sys_spawn (const char *file, char *const argv[]) {
+	size_t i;
+
+	check_string (file);
+	for (i = 0; ; i++) {
+		check_user (&argv[i], sizeof argv[i]);
+		if (argv[i] == NULL)
+			break;
+		check_string (argv[i]);
+	}
+	return process_spawn (file, argv);
+}
+
+static bool
+sys_create (const char *ufile, unsigned initial_size) {
+	char *file = copy_in_string (ufile);
+	bool success;
+
+	if (file == NULL)
+		return false;
+	lock_acquire (&filesys_lock);
+	success = filesys_create (file, initial_size);
+	lock_release (&filesys_lock);
+	palloc_free_page (file);
+	return success;
+}
+
+static bool
+sys_remove (const char *ufile) {
+	char *file = copy_in_string (ufile);
+	bool success;
+
+	if (file == NULL)
+		return false;
+	lock_acquire (&filesys_lock);
+	success = filesys_remove (file);
+	lock_release (&filesys_lock);
+	palloc_free_page (file);
+	return success;
+}
+
+static int
+sys_open (const char *uname) {
+	struct file **fd_table = thread_current ()->fd_table;
+	char *name = copy_in_string (uname);
+	struct file *file;
+	int fd;
+
+	if (name == NULL)
+		return -1;
+	lock_acquire (&filesys_lock);
+	file = filesys_open (name);
+	lock_release (&filesys_lock);
+	palloc_free_page (name);
+	if (file == NULL)
+		return -1;
+
+	for (fd = FD_MIN; fd < FD_MAX; fd++)
+		if (fd_table[fd] == NULL) {
+			fd_table[fd] = file;
+			return fd;
+		}
+	file_close (file);
+	return -1;
+}
+
+static int
+sys_filesize (int fd) {
+	struct file *file = fd_lookup (fd);
+	int size;
+
+	if (file == NULL)
+		return -1;
+	lock_acquire (&filesys_lock);
+	size = file_length (file);
+	lock_release (&filesys_lock);
+	return size;
+}
+
+/* sys_read() and sys_write() move file data through a kernel
+ * bounce page, a page at a time, so that user memory is only
+ * touched by copy_in() and copy_out() with no lock held.  A bad
+ * buffer kills the process between pages. */
+
+static int
+sys_read (int fd, void *buffer, unsigned size) {
+	struct file *file = NULL;
+	uint8_t *bounce;
+	unsigned bytes_read = 0;
+
+	if (size == 0)
+		return 0;
+	if (fd != STDIN_FILENO && (file = fd_lookup (fd)) == NULL)
+		return -1;
+	bounce = palloc_get_page (0);
+	if (bounce == NULL)
+		return -1;
+
+	while (bytes_read < size) {
+		unsigned chunk = size - bytes_read < PGSIZE ? size - bytes_read : PGSIZE;
+		unsigned got, i;
+
+		if (file == NULL) {
+			for (i = 0; i < chunk; i++)
+				bounce[i] = input_getc ();
+			got = chunk;
+		} else {
+			lock_acquire (&filesys_lock);
+			got = file_read (file, bounce, chunk);
+			lock_release (&filesys_lock);
+		}
+		if (!copy_out ((uint8_t *) buffer + bytes_read, bounce, got)) {
+			palloc_free_page (bounce);
+			sys_exit (-1);
+		}
+		bytes_read += got;
+		if (got < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	return bytes_read;
+}
+
+static int
+sys_write (int fd, const void *buffer, unsigned size) {
+	struct file *file = NULL;
+	uint8_t *bounce;
+	unsigned bytes_written = 0;
+
+	if (size == 0)
+		return 0;
+	if (fd != STDOUT_FILENO && (file = fd_lookup (fd)) == NULL)
+		return -1;
+	bounce = palloc_get_page (0);
+	if (bounce == NULL)
+		return -1;
+
+	while (bytes_written < size) {
+		unsigned chunk = size - bytes_written < PGSIZE
+			? size - bytes_written : PGSIZE;
+		unsigned put;
+
+		if (!copy_in (bounce, (const uint8_t *) buffer + bytes_written, chunk)) {
+			palloc_free_page (bounce);
+			sys_exit (-1);
+		}
+		if (file == NULL) {
+			putbuf ((const char *) bounce, chunk);
+			put = chunk;
+		} else {
+			lock_acquire (&filesys_lock);
+			put = file_write (file, bounce, chunk);
+			lock_release (&filesys_lock);
+		}
+		bytes_written += put;
+		if (put < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	return bytes_written;
+}
+
+static void
+sys_seek (int fd, unsigned position) {
+	struct file *file = fd_lookup (fd);
+
+	if (file != NULL)
+		file_seek (file, position);
+}
+
+static unsigned
+sys_tell (int fd) {
+	struct file *file = fd_lookup (fd);
+
+	return file != NULL ? file_tell (file) : 0;
+}
+
+static void
+sys_close (int fd) {
+	struct file *file = fd_lookup (fd);
+
+	if (file != NULL) {
+		thread_current ()->fd_table[fd] = NULL;
+		lock_acquire (&filesys_lock);
+		file_close (file);
+		lock_release (&filesys_lock);
+	}
 }
 
 /* The main system call interface */
 void
-syscall_handler (struct intr_frame *f UNUSED) {
-	// TODO: Your implementation goes here.
-	printf ("system call!\n");
-	thread_exit ();
+syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	/* Page faults on user memory taken inside the kernel need the
+	 * user's stack pointer to tell stack growth from a bad access. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
+	/* The number is in RAX, the arguments in RDI, RSI, RDX, R10, R8
+	 * and R9, and the result goes back in RAX. */
+	switch (f->R.rax) {
+		case SYS_HALT:
+			power_off ();
+		case SYS_EXIT:
+			sys_exit (f->R.rdi);
+		case SYS_FORK:
+			check_string ((const char *) f->R.rdi);
+			f->R.rax = process_fork ((const char *) f->R.rdi, f);
+			break;
+		case SYS_EXEC:
+			f->R.rax = sys_exec ((const char *) f->R.rdi);
+			break;
+		case SYS_SPAWN:
+			f->R.rax = sys_spawn ((const char *) f->R.rdi,
+					(char *const *) f->R.rsi);
+			break;
+		case SYS_WAIT:
+			f->R.rax = process_wait (f->R.rdi);
+			break;
+		case SYS_CREATE:
+			f->R.rax = sys_create ((const char *) f->R.rdi, f->R.rsi);
+			break;
+		case SYS_REMOVE:
+			f->R.rax = sys_remove ((const char *) f->R.rdi);
+			break;
+		case SYS_OPEN:
+			f->R.rax = sys_open ((const char *) f->R.rdi);
+			break;
+		case SYS_FILESIZE:
+			f->R.rax = sys_filesize (f->R.rdi);
+			break;
+		case SYS_READ:
+			f->R.rax = sys_read (f->R.rdi, (void *) f->R.rsi, f->R.rdx);
+			break;
+		case SYS_WRITE:
+			f->R.rax = sys_write (f->R.rdi, (const void *) f->R.rsi, f->R.rdx);
+			break;
+		case SYS_SEEK:
+			sys_seek (f->R.rdi, f->R.rsi);
+			break;
+		case SYS_TELL:
+			f->R.rax = sys_tell (f->R.rdi);
+			break;
+		case SYS_CLOSE:
+			sys_close (f->R.rdi);
+			break;
+		default:
+			sys_exit (-1);
+	}
 }
@@ -1,7 +1,14 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +24,297 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Swap space.
+ *
+ * The swap disk is divided into page-sized slots, and SWAP_SLOTS
+ * has a bit set for each one in use.  SLOT_REFS counts the pages
+ * whose data each slot holds: more than one if they shared a frame
+ * when it was evicted.  SLOT_PAGES maps each slot that holds the
+ * data of a single page to that page.
+ *
+ * Pages are not written out one at a time.  The slots are grouped
+ * into clusters of SWAP_CLUSTER, aligned on multiples of it, and
+ * SWAP_CLUSTERS has a bit set for each cluster with any slot in use.
+ * Swap-out reserves an empty cluster as a run, then copies each
+ * evicted page into the matching page of CLUSTER_BUF, and the whole
+ * run goes to disk in a single request once it is full.  Until then
+ * a page in the run is read back from CLUSTER_BUF.  Pages evicted
+ * together are usually neighbours in one process, so when one of
+ * them faults back in, the rest of its cluster is read with it and
+ * mapped into free frames before the process asks for them.  Only
+ * when no cluster is empty does a page get a slot of its own.
+ *
+ * SWAP_LOCK protects all of the above, and the SLOT of every anon
+ * page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+#define SWAP_CLUSTER 8
+#define NO_SLOT SIZE_MAX
+
+static size_t slot_cnt;
+static struct bitmap *swap_slots;
+static size_t cluster_cnt;
+static struct bitmap *swap_clusters;
+static struct page **slot_pages;
+static unsigned *slot_refs;
+static struct lock swap_lock;
+
+static uint8_t *cluster_buf;     /* Data of the pages in the run. */
+static size_t cluster_base;      /* First slot of the run, or NO_SLOT. */
+static size_t cluster_used;      /* Slots of the run filled. */
+static uint8_t *readaround_buf;  /* Data of a run read back in. */
+
+/* Statistics. */
+static unsigned long long out_cnt;        /* Pages swapped out. */
+static unsigned long long write_cnt;      /* Disk writes for them. */
+static unsigned long long in_cnt;         /* Pages swapped in. */
+static unsigned long long read_cnt;       /* Disk reads for them. */
+static unsigned long long readaround_cnt; /* Pages read in unasked. */
+
+static void swap_flush (void);
+static void slot_release (size_t slot);
+static void slot_free (size_t slot);
+static bool slot_staged (size_t slot);
+static bool slot_neighbour (size_t slot, struct thread *owner);
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	cluster_base = NO_SLOT;
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+	swap_slots = bitmap_create (slot_cnt);
+	cluster_cnt = slot_cnt / SWAP_CLUSTER;
+	swap_clusters = bitmap_create (cluster_cnt);
+	slot_pages = calloc (slot_cnt, sizeof *slot_pages);
+	slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+	cluster_buf = palloc_get_multiple (0, SWAP_CLUSTER);
+	readaround_buf = palloc_get_multiple (0, SWAP_CLUSTER);
+	if (swap_slots == NULL || swap_clusters == NULL || slot_pages == NULL
+			|| slot_refs == NULL || cluster_buf == NULL || readaround_buf == NULL)
+		PANIC ("cannot set up swap");
+	lock_init (&swap_lock);
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	/* Set up the handler.  The contents are up to the caller. */
 	page->operations = &anon_ops;
-
-	struct anon_page *anon_page = &page->anon;
+	page->anon.slot = NO_SLOT;
+	return true;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot, start, end, lo, hi, i;
+	bool around;
+
+	/* A page that never left memory is only "swapped in" by fork()
+	 * copying it, and has no data anywhere else. */
+	if (anon_page->slot == NO_SLOT)
+		return false;
+
+	lock_acquire (&swap_lock);
+	slot = anon_page->slot;
+	in_cnt++;
+	if (slot_staged (slot)) {
+		memcpy (kva, cluster_buf + (slot - cluster_base) * PGSIZE, PGSIZE);
+		slot_release (slot);
+		anon_page->slot = NO_SLOT;
+		lock_release (&swap_lock);
+		return true;
+	}
+
+	/* Read every slot around SLOT that holds another page of the same
+	 * process along with it.  Only the owner itself may bring its
+	 * pages in, so this is not done for fork() copying them. */
+	around = page->owner == thread_current ();
+	start = slot - slot % SWAP_CLUSTER;
+	end = start + SWAP_CLUSTER < slot_cnt ? start + SWAP_CLUSTER : slot_cnt;
+	lo = hi = slot;
+	for (i = start; around && i < end; i++)
+		if (slot_neighbour (i, page->owner)) {
+			lo = i < lo ? i : lo;
+			hi = i > hi ? i : hi;
+		}
+
+	disk_read_multiple (swap_disk, lo * SECTORS_PER_SLOT,
+			(hi - lo + 1) * SECTORS_PER_SLOT, readaround_buf);
+	read_cnt++;
+	memcpy (kva, readaround_buf + (slot - lo) * PGSIZE, PGSIZE);
+	slot_release (slot);
+	anon_page->slot = NO_SLOT;
+
+	for (i = lo; i <= hi; i++) {
+		struct page *other = slot_pages[i];
+
+		if (!slot_neighbour (i, page->owner))
+			continue;
+		if (!vm_readaround_page (other, readaround_buf + (i - lo) * PGSIZE))
+			break;
+		slot_release (i);
+		other->anon.slot = NO_SLOT;
+		in_cnt++;
+		readaround_cnt++;
+	}
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	size_t slot;
+
+	if (swap_disk == NULL)
+		return false;
+
+	lock_acquire (&swap_lock);
+	if (cluster_base == NO_SLOT) {
+		size_t cluster = bitmap_scan_and_flip (swap_clusters, 0, 1, false);
+
+		if (cluster == BITMAP_ERROR) {
+			/* No empty cluster for a run: write the page on its own.
+			 * Every cluster is in use already, so SLOT's is marked. */
+			size_t free_slot = bitmap_scan_and_flip (swap_slots, 0, 1, false);
+
+			if (free_slot == BITMAP_ERROR) {
+				lock_release (&swap_lock);
+				return false;
+			}
+			slot = free_slot;
+			disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+					SECTORS_PER_SLOT, page->frame->kva);
+			write_cnt++;
+			goto done;
+		}
+		cluster_base = cluster * SWAP_CLUSTER;
+		bitmap_set_multiple (swap_slots, cluster_base, SWAP_CLUSTER, true);
+		cluster_used = 0;
+	}
+
+	slot = cluster_base + cluster_used;
+	memcpy (cluster_buf + cluster_used * PGSIZE, page->frame->kva, PGSIZE);
+	cluster_used++;
+
+done:
+	slot_pages[slot] = page;
+	slot_refs[slot] = 1;
+	page->anon.slot = slot;
+	out_cnt++;
+	if (cluster_used == SWAP_CLUSTER)
+		swap_flush ();
+	lock_release (&swap_lock);
+	return true;
+}
+
+/* Gives OTHER, which held the same data as PAGE in the frame PAGE
+ * was just swapped out of, the same swap slot as PAGE.  Each of them
+ * reads the slot back into a frame of its own. */
+void
+anon_share_slot (struct page *page, struct page *other) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = page->anon.slot;
+	ASSERT (slot != NO_SLOT);
+	other->anon.slot = slot;
+	slot_refs[slot]++;
+
+	/* Read-around brings in the pages of one process only. */
+	slot_pages[slot] = NULL;
+	lock_release (&swap_lock);
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot == NO_SLOT)
+		return;
+	lock_acquire (&swap_lock);
+	slot_release (anon_page->slot);
+	anon_page->slot = NO_SLOT;
+	lock_release (&swap_lock);
+}
+
+/* Writes the run of slots being filled to disk, and gives back the
+ * slots in it that hold nothing any more.  The caller must hold
+ * SWAP_LOCK. */
+static void
+swap_flush (void) {
+	size_t base = cluster_base, i;
+
+	if (base == NO_SLOT)
+		return;
+	cluster_base = NO_SLOT;
+	if (cluster_used > 0) {
+		disk_write_multiple (swap_disk, base * SECTORS_PER_SLOT,
+				cluster_used * SECTORS_PER_SLOT, cluster_buf);
+		write_cnt++;
+	}
+	for (i = 0; i < SWAP_CLUSTER; i++)
+		if (slot_refs[base + i] == 0)
+			slot_free (base + i);
+	cluster_used = 0;
+}
+
+/* Drops a page's reference to SLOT, and frees it once no page's
+ * data are in it.  A slot of the run being filled stays reserved
+ * until the run is written, so that nothing else lands in it first.
+ * The caller must hold SWAP_LOCK. */
+static void
+slot_release (size_t slot) {
+	if (--slot_refs[slot] > 0)
+		return;
+	slot_pages[slot] = NULL;
+	if (!slot_staged (slot))
+		slot_free (slot);
+}
+
+/* Marks SLOT free, and its cluster too if that leaves the cluster
+ * empty.  The caller must hold SWAP_LOCK. */
+static void
+slot_free (size_t slot) {
+	size_t cluster = slot / SWAP_CLUSTER;
+
+	bitmap_reset (swap_slots, slot);
+	if (cluster < cluster_cnt
+			&& bitmap_none (swap_slots, cluster * SWAP_CLUSTER, SWAP_CLUSTER))
+		bitmap_reset (swap_clusters, cluster);
+}
+
+/* Returns whether SLOT is in the run being filled, so that its data
+ * are in CLUSTER_BUF instead of on disk. */
+static bool
+slot_staged (size_t slot) {
+	return cluster_base != NO_SLOT
+		&& slot >= cluster_base && slot < cluster_base + SWAP_CLUSTER;
+}
+
+/* Returns whether SLOT holds, on disk, another page of OWNER that
+ * is out of memory, so that it can be read in along with a page
+ * around it.  A page whose eviction has not quite finished still
+ * has its frame, and is left alone. */
+static bool
+slot_neighbour (size_t slot, struct thread *owner) {
+	struct page *page = slot_pages[slot];
+
+	return page != NULL && page->owner == owner && page->frame == NULL
+		&& !slot_staged (slot);
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	printf ("Swap: %llu pages out in %llu writes, "
+			"%llu in in %llu reads (%llu read around)\n",
+			out_cnt, write_cnt, in_cnt, read_cnt, readaround_cnt);
 }
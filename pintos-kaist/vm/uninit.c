@@ -10,6 +10,7 @@
 
 #include "vm/vm.h"
 #include "vm/uninit.h"
+#include "threads/malloc.h"
 
 static bool uninit_initialize (struct page *page, void *kva);
 static void uninit_destroy (struct page *page);
@@ -51,9 +52,28 @@ uninit_initialize (struct page *page, void *kva) {
 	vm_initializer *init = uninit->init;
 	void *aux = uninit->aux;
 
-	/* TODO: You may need to fix this function. */
-	return uninit->page_initializer (page, uninit->type, kva) &&
-		(init ? init (page, aux) : true);
+	bool success = uninit->page_initializer (page, uninit->type, kva);
+
+	/* A page with nothing to load was given a zeroed frame. */
+	if (success && init != NULL)
+		success = init (page, aux);
+
+	/* The page owns AUX, which is done with now. */
+	free (aux);
+	return success;
+}
+
+/* Turns PAGE into the page object it is waiting to become, around
+ * contents that are in place at KVA already, as when it shares
+ * another page's frame: the init callback is not run. */
+bool
+uninit_transmute (struct page *page, void *kva) {
+	struct uninit_page *uninit = &page->uninit;
+	void *aux = uninit->aux;
+	bool success = uninit->page_initializer (page, uninit->type, kva);
+
+	free (aux);
+	return success;
 }
 
 /* Free the resources hold by uninit_page. Although most of pages are transmuted
@@ -62,7 +82,6 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+	free (uninit->aux);
 }
@@ -1,9 +1,74 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Largest size the stack may grow to. */
+#define STACK_LIMIT (1 << 20)
+
+/* Frame table.
+ *
+ * Every frame that holds a mapped user page is on one of two
+ * lists, each swept by a clock hand: the front of a list is where
+ * its hand points, and a frame the hand passes over goes to the
+ * back.  A frame starts out on the inactive list.  It only moves
+ * to the active list if its accessed bit is found set on two
+ * sweeps of the inactive hand, so pages touched once, as by a
+ * scan through a large buffer, are evicted without pushing the
+ * working set out.  The active hand runs whenever the active list
+ * outgrows the inactive one, and moves frames that were not used
+ * since it last came around back to the inactive list.
+ *
+ * A frame is pinned while the hand must leave it alone: while its
+ * page is evicted, and while its data are copied.  A frame that
+ * fork() or shared text left holding the pages of several
+ * processes is evicted from all of their page tables at once, and
+ * its data go to a single swap slot that they share.  FRAME_LOCK
+ * protects the lists, the counters, and every frame's PINNED,
+ * ACTIVE and REFERENCED members and its pages, as well as the link
+ * between a page and its frame while the frame is on a list or
+ * pinned.
+ *
+ * Frames of the page cache are in the frame table too, so that file
+ * data and user pages compete for memory on the same terms.  Their
+ * pages have no owner and are not mapped: the page cache tracks
+ * their use, and takes them out of the cache when they are
+ * evicted.  The page cache never calls in here while holding its
+ * own lock, so FRAME_LOCK may be held while taking that lock.
+ *
+ * Frames that hold the read-only text of a program are also kept
+ * in TEXT_FRAMES, by file and offset, so that every process that
+ * runs the program maps the same frames instead of reading its own
+ * copy.  FRAME_LOCK protects it too. */
+static struct list active_frames;
+static struct list inactive_frames;
+static size_t active_cnt, inactive_cnt;
+static struct lock frame_lock;
+static struct condition frame_unpinned;
+static struct hash text_frames;
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* A page of zeros that every untouched anonymous page is mapped to,
+ * read-only, until it is first written. */
+static void *zero_kva;
+
+/* Statistics. */
+static unsigned long long scan_cnt;      /* Frames looked at by a hand. */
+static unsigned long long evict_cnt;     /* Pages evicted. */
+static unsigned long long writeback_cnt; /* Evicted pages that were dirty. */
+static unsigned long long share_cnt;     /* Pages shared by fork(). */
+static unsigned long long copy_cnt;      /* Shared pages copied on write. */
+static unsigned long long text_hit_cnt;  /* Text pages found in memory. */
+static unsigned long long zero_map_cnt;  /* Read faults on the zero page. */
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -15,7 +80,12 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&active_frames);
+	list_init (&inactive_frames);
+	lock_init (&frame_lock);
+	cond_init (&frame_unpinned);
+	hash_init (&text_frames, text_hash, text_less, NULL);
+	zero_kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -36,10 +106,16 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static void page_free (struct page *page, uint64_t *pml4);
+static bool page_is_blank (struct page *page);
+static hash_hash_func page_hash;
+static hash_less_func page_less;
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.
+ * AUX, if not null, must come from malloc().  The page takes it over and
+ * frees it once INIT has run or when the page is destroyed. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
@@ -50,11 +126,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
 
-		/* TODO: Insert the page into the spt. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,80 +159,558 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
+	ASSERT (is_user_vaddr (page->va));
 
-	return succ;
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
+/* Removes PAGE from SPT and frees it, unmapping it if it is
+ * mapped. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+	hash_delete (&spt->pages, &page->spt_elem);
+	page_free (page, spt->owner->pml4);
+}
+
+/* Calls ACTION for each page in SPT, in no particular order,
+ * until ACTION returns false.  ACTION must not add pages to SPT
+ * or remove them.  Returns false if ACTION stopped the iteration,
+ * true otherwise. */
+bool
+spt_for_each (struct supplemental_page_table *spt, spt_action_func *action,
+		void *aux) {
+	struct hash_iterator i;
+
+	hash_first (&i, &spt->pages);
+	while (hash_next (&i))
+		if (!action (hash_entry (hash_cur (&i), struct page, spt_elem), aux))
+			return false;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls ACTION for each page of SPT between user addresses START
+ * and END, in ascending order, until ACTION returns false.  Each
+ * page in the range costs one table lookup, however large SPT is.
+ * ACTION may remove the page it is given.  Returns false if
+ * ACTION stopped the iteration, true otherwise. */
+bool
+spt_for_range (struct supplemental_page_table *spt, void *start, void *end,
+		spt_action_func *action, void *aux) {
+	uint8_t *va;
+
+	for (va = pg_round_down (start); va < (uint8_t *) end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		if (page != NULL && !action (page, aux))
+			return false;
+	}
+	return true;
+}
+
+/* Returns true if any of FRAME's pages was accessed since the bits
+ * were last cleared, and clears them. */
+static bool
+frame_test_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4;
+
+#ifdef EFILESYS
+		if (page->owner == NULL) {
+			if (page_cache_test_accessed (page))
+				accessed = true;
+			continue;
+		}
+#endif
+		pml4 = page->owner->pml4;
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Makes FRAME hold the data of PAGE, as well as of any pages it
+ * already holds. */
+static void
+frame_add_page (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	if (frame->page_cnt++ == 0)
+		frame->page = page;
+	page->frame = frame;
+}
+
+/* Takes PAGE off FRAME's pages, and returns how many are left.
+ * PAGE's own link to FRAME is left for the caller to clear. */
+static size_t
+frame_del_page (struct frame *frame, struct page *page) {
+	list_remove (&page->frame_elem);
+	if (--frame->page_cnt == 0)
+		frame->page = NULL;
+	else if (frame->page == page)
+		frame->page = list_entry (list_front (&frame->pages),
+				struct page, frame_elem);
+	return frame->page_cnt;
+}
+
+/* Takes FRAME, which holds no pages any more, out of the text
+ * frame table if it is there. */
+static void
+frame_forget_text (struct frame *frame) {
+	if (frame->text.inode != NULL) {
+		hash_delete (&text_frames, &frame->text_elem);
+		frame->text.inode = NULL;
+	}
+}
+
+/* Puts FRAME, which must not be on a list, on the back of the
+ * active or the inactive list. */
+static void
+frame_push (struct frame *frame, bool active) {
+	frame->active = active;
+	if (active) {
+		list_push_back (&active_frames, &frame->elem);
+		active_cnt++;
+	} else {
+		list_push_back (&inactive_frames, &frame->elem);
+		inactive_cnt++;
+	}
+}
+
+/* Removes FRAME from the list it is on. */
+static void
+frame_remove (struct frame *frame) {
+	list_remove (&frame->elem);
+	if (frame->active)
+		active_cnt--;
+	else
+		inactive_cnt--;
+}
+
+/* Get the struct frame, that will be evicted.  Takes it off the
+ * frame table and pins it.  Returns a null pointer if every frame
+ * is pinned.  The caller must hold frame_lock. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t pinned_run = 0;
+
+	while (pinned_run < active_cnt + inactive_cnt) {
+		struct frame *frame;
+
+		if (active_cnt > inactive_cnt) {
+			/* Age the active list. */
+			frame = list_entry (list_pop_front (&active_frames),
+					struct frame, elem);
+			active_cnt--;
+			scan_cnt++;
+			if (!frame->pinned && frame_test_accessed (frame))
+				frame_push (frame, true);
+			else {
+				frame->referenced = false;
+				frame_push (frame, false);
+			}
+			continue;
+		}
 
-	return victim;
+		frame = list_entry (list_pop_front (&inactive_frames),
+				struct frame, elem);
+		inactive_cnt--;
+		scan_cnt++;
+		if (frame->pinned) {
+			pinned_run++;
+			frame_push (frame, false);
+			continue;
+		}
+		pinned_run = 0;
+
+		if (frame_test_accessed (frame)) {
+			/* Second chance, or promotion on the second use. */
+			if (frame->referenced) {
+				frame->referenced = false;
+				frame_push (frame, true);
+			} else {
+				frame->referenced = true;
+				frame_push (frame, false);
+			}
+			continue;
+		}
+
+		frame->pinned = true;
+		return frame;
+	}
+	return NULL;
+}
+
+/* Unmaps every page of FRAME, which is pinned, so that their owners
+ * cannot change it while it is written out; a fault on any of them
+ * waits for us.  Returns whether any of them was dirty.  A page of
+ * the page cache is not mapped. */
+static bool
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+	bool dirty = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4;
+
+		if (page->owner == NULL)
+			continue;
+		pml4 = page->owner->pml4;
+		if (pml4_is_dirty (pml4, page->va))
+			dirty = true;
+		pml4_clear_page (pml4, page->va);
+	}
+	return dirty;
+}
+
+/* Maps every page of FRAME again after a failed eviction.  Pages
+ * that share the frame may only read it. */
+static void
+frame_remap (struct frame *frame, bool dirty) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4;
+
+		if (page->owner == NULL)
+			continue;
+		pml4 = page->owner->pml4;
+		pml4_set_page (pml4, page->va, frame->kva,
+				page->writable && frame->page_cnt == 1);
+		if (dirty)
+			pml4_set_dirty (pml4, page->va, true);
+	}
 }
 
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	size_t tries;
+
+	lock_acquire (&frame_lock);
+	for (tries = active_cnt + inactive_cnt; tries > 0; tries--) {
+		struct frame *victim = vm_get_victim ();
+		struct page *page;
+		bool cached, dirty;
+
+		if (victim == NULL)
+			break;
+		lock_release (&frame_lock);
 
+		page = victim->page;
+		cached = page->owner == NULL;
+		dirty = frame_unmap (victim);
+
+		if (swap_out (page)) {
+			struct list_elem *e;
+
+			/* Only anonymous pages share frames. */
+			for (e = list_begin (&victim->pages);
+					e != list_end (&victim->pages); e = list_next (e)) {
+				struct page *other = list_entry (e, struct page, frame_elem);
+
+				if (other != page)
+					anon_share_slot (page, other);
+			}
+
+			lock_acquire (&frame_lock);
+			if (dirty)
+				writeback_cnt++;
+			while (victim->page_cnt > 0) {
+				struct page *p = victim->page;
+
+				frame_del_page (victim, p);
+				p->frame = NULL;
+				evict_cnt++;
+			}
+			frame_forget_text (victim);
+			cond_broadcast (&frame_unpinned, &frame_lock);
+			lock_release (&frame_lock);
+
+			/* A page of the page cache has left the cache. */
+			if (cached)
+				vm_dealloc_page (page);
+			return victim;
+		}
+
+		/* The page cannot go anywhere: map it again, and move it
+		 * out of the hand's way. */
+		frame_remap (victim, dirty);
+		lock_acquire (&frame_lock);
+		victim->pinned = false;
+		frame_push (victim, true);
+		cond_broadcast (&frame_unpinned, &frame_lock);
+	}
+	lock_release (&frame_lock);
 	return NULL;
 }
 
+/* Returns a new frame on a free page of the user pool, zeroed if
+ * ZERO, or a null pointer if the pool is empty. */
+static struct frame *
+frame_alloc (bool zero) {
+	struct frame *frame;
+	void *kva = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+
+	if (kva == NULL)
+		return NULL;
+	frame = malloc (sizeof *frame);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->page_cnt = 0;
+	frame->text.inode = NULL;
+	return frame;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  Returns a null
+ * pointer only if nothing can be evicted.  The frame is not in the frame
+ * table until its page is claimed.  If ZERO, the frame is zeroed; the
+ * user pool keeps pages zeroed ahead of time for this. */
 static struct frame *
-vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+vm_get_frame (bool zero) {
+	struct frame *frame = frame_alloc (zero);
+
+	if (frame == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			return NULL;
+		if (zero)
+			memset (frame->kva, 0, PGSIZE);
+	}
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	ASSERT (frame->page_cnt == 0);
+	frame->pinned = true;
+	frame->active = false;
+	frame->referenced = false;
 	return frame;
 }
 
+/* Frees FRAME, which is not in the frame table, and returns its
+ * memory to the user pool. */
+static void
+vm_free_frame (struct frame *frame) {
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Pins the frame of PAGE, so that it stays in memory until
+ * vm_unpin_page().  Returns false, without pinning anything, if
+ * PAGE is not in memory. */
+static bool
+vm_pin_page (struct page *page) {
+	bool resident;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_unpinned, &frame_lock);
+	resident = page->frame != NULL;
+	if (resident)
+		page->frame->pinned = true;
+	lock_release (&frame_lock);
+	return resident;
+}
+
+/* Unpins the frame of PAGE. */
+static void
+vm_unpin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	page->frame->pinned = false;
+	cond_broadcast (&frame_unpinned, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+#ifdef EFILESYS
+/* Gives PAGE, a page of the page cache, a frame, evicting another
+ * page if memory is short, and enters the frame in the frame table,
+ * where it may in turn be evicted through swap_out().  Returns
+ * false if no frame can be had.  The page cache must keep PAGE from
+ * being evicted while it fills it in. */
+bool
+vm_claim_cache_page (struct page *page) {
+	struct frame *frame = vm_get_frame (false);
+
+	if (frame == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	frame_add_page (frame, page);
+	frame->pinned = false;
+	frame_push (frame, false);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Takes the frame of PAGE, a page of the page cache that the page
+ * cache keeps from being evicted, out of the frame table, and frees
+ * both. */
+void
+vm_free_cache_page (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_unpinned, &frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		frame_del_page (frame, page);
+		frame_remove (frame);
+	}
+	lock_release (&frame_lock);
+
+	vm_dealloc_page (page);
+	if (frame != NULL)
+		vm_free_frame (frame);
+}
+#endif
+
+/* Prints frame table statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frames: %llu scanned, %llu evicted, %llu dirty written back\n",
+			scan_cnt, evict_cnt, writeback_cnt);
+	printf ("Copy-on-write: %llu pages shared, %llu copied\n",
+			share_cnt, copy_cnt);
+	printf ("Text: %llu pages found in memory\n", text_hit_cnt);
+	printf ("Zero: %llu pages read before written\n", zero_map_cnt);
+	vm_anon_print_stats ();
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON, pg_round_down (addr), true);
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page.  PAGE is one that
+ * fork() left sharing its frame: it gets a frame of its own, or
+ * just write access if nobody else uses the frame any more. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *old, *new;
+
+	if (!page->writable)
+		return false;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_unpinned, &frame_lock);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted since the fault, or never written and still on
+		 * the zero page: give it a frame of its own. */
+		lock_release (&frame_lock);
+		return vm_do_claim_page (page);
+	}
+	if (old->page_cnt == 1) {
+		pml4_set_page (pml4, page->va, old->kva, true);
+		lock_release (&frame_lock);
+		return true;
+	}
+	old->pinned = true;
+	lock_release (&frame_lock);
+
+	new = vm_get_frame (false);
+	if (new != NULL)
+		memcpy (new->kva, old->kva, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	if (new != NULL) {
+		frame_del_page (old, page);
+		frame_add_page (new, page);
+		pml4_set_page (pml4, page->va, new->kva, true);
+		new->pinned = false;
+		frame_push (new, false);
+		copy_cnt++;
+	}
+	old->pinned = false;
+	cond_broadcast (&frame_unpinned, &frame_lock);
+	lock_release (&frame_lock);
+	return new != NULL;
+}
+
+/* Returns true if PAGE has never been brought in and has nothing to
+ * load, so that its contents are all zeros. */
+static bool
+page_is_blank (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& page->uninit.init == NULL;
+}
+
+/* Returns true if a fault at ADDR with stack pointer RSP looks
+ * like an access to the stack that should grow it. */
+static bool
+is_stack_access (void *addr, uintptr_t rsp) {
+	uintptr_t va = (uintptr_t) addr;
+
+	return va >= rsp - 8 && va < USER_STACK && va >= USER_STACK - STACK_LIMIT;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *curr = thread_current ();
+	struct supplemental_page_table *spt = &curr->spt;
+	struct page *page;
+
+	/* Validate the fault */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (!not_present)
+		return page != NULL && write && vm_handle_wp (page);
+
+	if (page == NULL) {
+		/* A fault in the kernel happens on the kernel stack, so
+		 * look at the user stack pointer saved on entry instead. */
+		uintptr_t rsp = user ? f->rsp : curr->user_rsp;
+
+		if (!is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+	}
+	if (write && !page->writable)
+		return false;
+
+	/* Reading memory that was never written needs no frame. */
+	if (!write && page_is_blank (page) && page_get_type (page) == VM_ANON) {
+		zero_map_cnt++;
+		return pml4_set_page (page->owner->pml4, page->va, zero_kva, false);
+	}
 
 	return vm_do_claim_page (page);
 }
@@ -148,43 +723,335 @@ vm_dealloc_page (struct page *page) {
 	free (page);
 }
 
+/* Marks the page at UPAGE, which is read-only and not loaded yet,
+ * as holding the READ_BYTES bytes at OFS in INODE followed by
+ * zeros, so that it may share a frame with any other page that
+ * holds the same. */
+void
+vm_share_text (void *upage, struct inode *inode, off_t ofs,
+		size_t read_bytes) {
+	struct page *page = spt_find_page (&thread_current ()->spt, upage);
+
+	ASSERT (page != NULL && !page->writable);
+	ASSERT (VM_TYPE (page->operations->type) == VM_UNINIT);
+
+	page->text.inode = inode;
+	page->text.ofs = ofs;
+	page->text.read_bytes = read_bytes;
+}
+
+/* Maps PAGE, a page of text that was never loaded, to a frame that
+ * holds its data if another process has one in memory.  Returns
+ * false if none is. */
+static bool
+claim_text_page (struct page *page) {
+	struct frame key, *frame = NULL;
+	struct hash_elem *e;
+	bool success = false;
+
+	key.text = page->text;
+	lock_acquire (&frame_lock);
+	e = hash_find (&text_frames, &key.text_elem);
+	if (e != NULL)
+		frame = hash_entry (e, struct frame, text_elem);
+
+	/* Leave a frame that is on its way out alone. */
+	if (frame != NULL && !frame->pinned
+			&& pml4_set_page (page->owner->pml4, page->va, frame->kva, false)) {
+		frame_add_page (frame, page);
+		uninit_transmute (page, frame->kva);
+		text_hit_cnt++;
+		success = true;
+	}
+	lock_release (&frame_lock);
+	return success;
+}
+
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Claim the PAGE and set up the mmu: brings PAGE into a frame,
+ * maps it in its owner's page table and adds the frame to the
+ * frame table.  The data goes in before the mapping, so the user
+ * never sees a half-read page. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+
+	/* Wait out an eviction of PAGE that is in progress. */
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_unpinned, &frame_lock);
+	frame = page->frame;
+	lock_release (&frame_lock);
+	if (frame != NULL)
+		return true;
+
+	/* Text that has never been loaded may be in memory already. */
+	if (page->text.inode != NULL
+			&& VM_TYPE (page->operations->type) == VM_UNINIT
+			&& claim_text_page (page))
+		return true;
+
+	frame = vm_get_frame (page_is_blank (page));
+	if (frame == NULL)
+		return false;
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_add_page (frame, page);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		page->frame = NULL;
+		vm_free_frame (frame);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	lock_acquire (&frame_lock);
+	frame->pinned = false;
+	frame_push (frame, false);
+	/* Offer the text to the next process that runs the program.  If
+	 * another one just loaded the same, keep that one on offer. */
+	if (page->text.inode != NULL) {
+		frame->text = page->text;
+		if (hash_insert (&text_frames, &frame->text_elem) != NULL)
+			frame->text.inode = NULL;
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Brings PAGE, which is swapped out, back in with DATA, its contents
+ * read from swap along with another page of the same process.  Only a
+ * free frame is used: nothing is evicted for data nobody asked for
+ * yet.  The frame goes on the inactive list unreferenced, so it is
+ * the first to go again if the guess was wrong. */
+bool
+vm_readaround_page (struct page *page, const void *data) {
+	struct frame *frame;
+
+	ASSERT (page->frame == NULL);
+
+	frame = frame_alloc (false);
+	if (frame == NULL)
+		return false;
+	memcpy (frame->kva, data, PGSIZE);
+	frame_add_page (frame, page);
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		page->frame = NULL;
+		vm_free_frame (frame);
+		return false;
+	}
+
+	lock_acquire (&frame_lock);
+	frame->pinned = false;
+	frame->referenced = false;
+	frame_push (frame, false);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Destroys PAGE, which is no longer in any SPT, and frees it,
+ * along with its mapping in PML4 and its frame, unless the frame
+ * is shared with other pages. */
+static void
+page_free (struct page *page, uint64_t *pml4) {
+	struct frame *frame;
+	void *va = page->va;
+	bool last;
+
+	/* Wait out an eviction in progress, then take the frame out of
+	 * the hands' way. */
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->pinned)
+		cond_wait (&frame_unpinned, &frame_lock);
+	frame = page->frame;
+	last = frame != NULL && frame_del_page (frame, page) == 0;
+	if (last) {
+		frame_remove (frame);
+		frame_forget_text (frame);
+	}
+	lock_release (&frame_lock);
+
+	/* The type's destroy() may still look at the data.  A page on
+	 * the zero page is mapped without a frame, and must not be left
+	 * for pml4_destroy() to free. */
+	vm_dealloc_page (page);
+	pml4_clear_page (pml4, va);
+	if (last)
+		vm_free_frame (frame);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	spt->owner = thread_current ();
+}
+
+/* Gives the current thread a page of the executable at the same
+ * address as SRC_PAGE, a page of another process that was never
+ * loaded.  It keeps SRC_PAGE's text key, so that read-only text
+ * still finds a frame that is in memory already. */
+static bool
+copy_segment_page (struct page *src_page) {
+	struct segment_aux *aux = malloc (sizeof *aux);
+	struct page *dst_page;
+
+	if (aux == NULL)
+		return false;
+	*aux = *(struct segment_aux *) src_page->uninit.aux;
+	if (!vm_alloc_page_with_initializer (page_get_type (src_page),
+				src_page->va, src_page->writable, lazy_load_segment, aux)) {
+		free (aux);
+		return false;
+	}
+	dst_page = spt_find_page (&thread_current ()->spt, src_page->va);
+	dst_page->text = src_page->text;
+	return true;
+}
+
+/* Gives the current thread a copy of SRC_PAGE, a page of another
+ * process.  A page of the executable that was never loaded stays
+ * that way in the copy, which loads it on its own first fault.  An
+ * anonymous page is not copied but shared: both processes map its
+ * frame read-only, and the first to write to it gets a copy from
+ * vm_handle_wp().  Any other page is copied into a new anonymous
+ * page. */
+static bool
+copy_page (struct page *src_page, void *aux UNUSED) {
+	struct thread *curr = thread_current ();
+	uint64_t *src_pml4 = src_page->owner->pml4;
+	void *va = src_page->va;
+	struct page *dst_page;
+	struct frame *frame;
+
+	/* A page that holds nothing yet stays that way in the copy. */
+	if (page_is_blank (src_page))
+		return vm_alloc_page (page_get_type (src_page), va,
+				src_page->writable);
+	if (VM_TYPE (src_page->operations->type) == VM_UNINIT
+			&& src_page->uninit.init == lazy_load_segment)
+		return copy_segment_page (src_page);
+
+	/* Bring in the source page, and keep it in memory while it is
+	 * copied. */
+	while (!vm_pin_page (src_page))
+		if (!vm_do_claim_page (src_page))
+			return false;
+	frame = src_page->frame;
+
+	if (VM_TYPE (src_page->operations->type) != VM_ANON) {
+		bool success = (vm_alloc_page (VM_ANON, va, src_page->writable)
+				&& vm_claim_page (va));
+		if (success)
+			memcpy (spt_find_page (&curr->spt, va)->frame->kva, frame->kva,
+					PGSIZE);
+		vm_unpin_page (src_page);
+		return success;
+	}
+
+	dst_page = malloc (sizeof *dst_page);
+	if (dst_page == NULL)
+		goto fail;
+	*dst_page = *src_page;
+	dst_page->owner = curr;
+	if (!spt_insert_page (&curr->spt, dst_page))
+		goto fail;
+	if (!pml4_set_page (curr->pml4, va, frame->kva, false)) {
+		hash_delete (&curr->spt.pages, &dst_page->spt_elem);
+		goto fail;
+	}
+
+	/* The source must not write to the frame in place any more
+	 * either.  Its dirty bit stays, for eviction's sake. */
+	if (src_page->writable) {
+		bool dirty = pml4_is_dirty (src_pml4, va);
+
+		pml4_set_page (src_pml4, va, frame->kva, false);
+		if (dirty)
+			pml4_set_dirty (src_pml4, va, true);
+	}
+
+	lock_acquire (&frame_lock);
+	frame_add_page (frame, dst_page);
+	share_cnt++;
+	frame->pinned = false;
+	cond_broadcast (&frame_unpinned, &frame_lock);
+	lock_release (&frame_lock);
+	return true;
+
+fail:
+	free (dst_page);
+	vm_unpin_page (src_page);
+	return false;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	ASSERT (dst->owner == thread_current ());
+	return spt_for_each (src, copy_page, NULL);
+}
+
+/* Frees the page at E, in the SPT of the current thread. */
+static void
+page_destructor (struct hash_elem *e, void *aux UNUSED) {
+	page_free (hash_entry (e, struct page, spt_elem),
+			thread_current ()->pml4);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	ASSERT (spt->owner == thread_current ());
+	hash_clear (&spt->pages, page_destructor);
+}
+
+/* Returns a hash value for the page at E. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+/* Orders pages by user address. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page *a = hash_entry (a_, struct page, spt_elem);
+	const struct page *b = hash_entry (b_, struct page, spt_elem);
+	return a->va < b->va;
+}
+
+/* Returns a hash value for the text frame at E. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *frame = hash_entry (e, struct frame, text_elem);
+	return (hash_bytes (&frame->text.inode, sizeof frame->text.inode)
+			^ hash_int (frame->text.ofs));
+}
+
+/* Orders text frames by file, offset and length. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_key *a = &hash_entry (a_, struct frame, text_elem)->text;
+	const struct text_key *b = &hash_entry (b_, struct frame, text_elem)->text;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
 }